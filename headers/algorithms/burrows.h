@@ -28,6 +28,8 @@
 #include <vector>
 #include <string>
 #include "sorting.h"
+#include "suffix_array.h"
+#include "fm_index.h"
 
 using namespace std;
 
@@ -114,17 +116,12 @@ struct BurrowsWheeler
 	}
 	
 	//Build columnB (the encoded string) from a raw string (assumes A is already built)
-	private: void buildB(string &str)
+	private: void buildB(string &str, int threads)
 	{
 		//Build the sequence-block table
-		vector<int> blockstarts(length,0);
+		vector<SuffixSort::Index> blockstarts;
 
-		for (int i=0; i<length; ++i)
-		{
-			blockstarts[i] = i;
-		}
-
-		//Sort the sequence blocks by alphabetical order
+		//Sort the sequence blocks by alphabetical order (linear time, so it scales to whole genomes)
 		comparator.seq = str;
 		comparator.len = length;
 		
@@ -132,8 +129,9 @@ struct BurrowsWheeler
 		//BZSort sorter;
 		//CachedBlockSort sorter;
 		//CrossThreadSort sorter;
-		BlockSort sorter;
-		sorter.sort(str, blockstarts);		
+		//BlockSort sorter;
+		//sorter.sort(str, blockstarts);
+		SuffixSort::sort_rotations(str, blockstarts, threads);
 		//sort(blockstarts.begin(), blockstarts.end(), comparator);
 		
 		//Build columnB (the encoding)
@@ -190,8 +188,8 @@ struct BurrowsWheeler
 		}
 	}
 	
-	//Take a raw string and encode it
-	public: void encode(string &decoded)
+	//Take a raw string and encode it (sorting with a number of threads)
+	public: void encode(string &decoded, int threads = 1)
 	{
 		if (decoded.size() == 0) return;
 		
@@ -201,7 +199,7 @@ struct BurrowsWheeler
 		columnB.resize(length);
 		
 		buildA(original);
-		buildB(original);
+		buildB(original, threads);
 		build_index();
 	}
 		
@@ -364,7 +362,46 @@ struct BurrowsWheeler
 		}
 	}
 	
-	//TODO: loading and saving with compression steps
-	void load(string infile)  { cerr << "BurrowsWheeler::load not implemented yet" << endl; }
-	void save(string outfile) { cerr << "BurrowsWheeler::save not implemented yet" << endl; }
+	//Load an encoding saved with save() and rebuild the index from it
+	public: bool load(string infile)
+	{
+		ifstream in (infile.c_str(), ios::binary);
+		char magic[8];
+		int header[2];
+
+		if (!in.read(magic, 8) || string(magic, 8) != "RSLAMBWT" || !in.read((char*)header, sizeof(header)))
+		{
+			cerr << "Not a Burrows-Wheeler file: " << infile << endl;
+			return false;
+		}
+		string encoded (header[0], '\0');
+
+		if (header[0] > 0 && !in.read(&(encoded[0]), header[0]))
+		{
+			cerr << "Burrows-Wheeler file is truncated: " << infile << endl;
+			return false;
+		}
+		decode(encoded, header[1]);
+		return true;
+	}
+
+	//Save the encoding (columnB and the seed). Everything else is rebuilt on loading
+	//Note: for DNA, FMIndex (fm_index.h) is the compact, directly searchable alternative
+	public: bool save(string outfile)
+	{
+		ofstream out (outfile.c_str(), ios::binary);
+
+		if (!out.good())
+		{
+			cerr << "Unable to write Burrows-Wheeler file: " << outfile << endl;
+			return false;
+		}
+		int header[2] = { length, seed };
+
+		out.write("RSLAMBWT", 8);
+		out.write((const char*)header, sizeof(header));
+		out.write(columnB.data(), columnB.size());
+		out.close();
+		return true;
+	}
 };
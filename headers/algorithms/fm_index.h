@@ -0,0 +1,377 @@
+/*
+ * FM-index of a DNA sequence: a 2-bit Burrows-Wheeler string with occurrence
+ * checkpoints and a sampled suffix array.
+ *
+ * Layout (per 128 rows of the matrix, 48 bytes):
+ *   counts[4] - occurrences of A,C,G,T in all rows before the block
+ *   bits[4]   - the 128 BWT characters of the block, 2 bits each
+ *
+ * rank(c,i) is one checkpoint read plus at most four popcounts, so counting the
+ * occurrences of a pattern is O(m). The suffix array is kept for every sa_rate
+ * rows; other rows are located by stepping back through the text (LF mapping)
+ * until a sampled row is reached.
+ *
+ * Memory is 0.375 bytes per base for the BWT and checkpoints, plus 4/sa_rate
+ * bytes per base for the samples (about 1.35GB for a human genome at rate 64).
+ *
+ * The text is terminated by a unique '$' (the smallest character). Anything that
+ * is not A, C, G or T is replaced with a pseudo-random base, so hits that cover
+ * an N must be verified against the reference by the caller.
+ */
+#pragma once
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <pthread.h>
+#include "suffix_array.h"
+
+using namespace std;
+
+struct FMIndex
+{
+	static const int BLOCK = 128;      //Rows per checkpoint
+	static const int VERSION = 1;
+
+	struct Block
+	{
+		unsigned int counts[4];
+		unsigned long long bits[4];
+	};
+
+	//A half open range of rows [lo, hi) of the sorted matrix
+	struct Range
+	{
+		long lo, hi;
+
+		bool empty() const { return hi <= lo; }
+		long size()  const { return hi - lo; }
+	};
+
+	vector<Block> blocks;         //BWT and checkpoints
+	vector<unsigned int> samples; //Suffix array entries for rows 0, sa_rate, 2*sa_rate...
+	long starts[5];               //First row for each character ('$' first, then A,C,G,T)
+	long length;                  //Text length (the matrix has length+1 rows)
+	long primary;                 //The row whose BWT character is '$'
+	int  sa_rate;
+
+	 FMIndex() { clear(); }
+	~FMIndex() { clear(); }
+
+	void clear()
+	{
+		vector<Block>().swap(blocks);
+		vector<unsigned int>().swap(samples);
+		memset(starts, 0, sizeof(starts));
+		length = 0;
+		primary = 0;
+		sa_rate = 64;
+	}
+
+	//2-bit code of a base, or -1 for anything else
+	static inline int code(char c)
+	{
+		switch (c)
+		{
+			case 'A' : return 0;
+			case 'C' : return 1;
+			case 'G' : return 2;
+			case 'T' : return 3;
+		}
+		return -1;
+	}
+
+	//Bytes of memory used
+	long memory()
+	{
+		return blocks.capacity() * sizeof(Block) + samples.capacity() * sizeof(unsigned int);
+	}
+
+	//Build the index for a DNA sequence (the suffix sort and BWT are spread over a number of threads)
+	public: void build(const string& sequence, int sa_rate = 64, int threads = 1)
+	{
+		clear();
+		this->sa_rate = sa_rate;
+		this->length = sequence.size();
+
+		//Clean the text
+		string text (length, 'A');
+		unsigned int random = 11;
+
+		for (long i=0; i<length; ++i)
+		{
+			int c = code(sequence[i]);
+
+			if (c == -1)
+			{
+				random = random * 1103515245 + 12345;
+				c = (random >> 16) & 3;
+			}
+			text[i] = "ACGT"[c];
+		}
+
+		//Sort the suffixes (SA-IS, linear time). The terminator makes rotation order the same as suffix order
+		vector<SuffixSort::Index> sa;
+		SuffixSort::sort_dna(text, sa, threads);
+
+		text += '$';
+		build_bwt(text, sa, threads);
+	}
+
+	//Work for one thread of build_bwt (a range of blocks)
+	struct Fill
+	{
+		FMIndex* index;
+		const string* text;
+		const vector<SuffixSort::Index>* sa;
+		long first;
+		long last;
+	};
+
+	//Build the BWT, checkpoints and samples from a terminated text and its suffix array
+	public: void build_bwt(const string& text, const vector<SuffixSort::Index>& sa, int threads = 1)
+	{
+		long rows = text.size();
+		length = rows - 1;
+
+		blocks.resize(rows / BLOCK + 1);
+		samples.resize((rows + sa_rate - 1) / sa_rate);
+		memset(&(blocks[0]), 0, blocks.size() * sizeof(Block));
+
+		//Each thread fills whole blocks, counting only the bases within each block
+		long nblocks = blocks.size();
+		threads = max(1, (int)min((long)threads, nblocks));
+
+		vector<Fill> work (threads);
+		vector<pthread_t> pool (threads);
+
+		for (int t=0; t<threads; ++t)
+		{
+			Fill f = { this, &text, &sa, nblocks * t / threads, nblocks * (t+1) / threads };
+			work[t] = f;
+		}
+		if (threads == 1)
+		{
+			fill_blocks(work[0]);
+		}
+		else
+		{
+			for (int t=0; t<threads; ++t)
+			{
+				pthread_create(&(pool[t]), NULL, thread_exec_fill, &(work[t]));
+			}
+			for (int t=0; t<threads; ++t)
+			{
+				pthread_join(pool[t], NULL);
+			}
+		}
+
+		//Turn the per block counts into checkpoints (occurrences before each block)
+		unsigned int totals[4] = {0, 0, 0, 0};
+
+		for (long b=0; b<nblocks; ++b)
+		{
+			for (int c=0; c<4; ++c)
+			{
+				unsigned int n = blocks[b].counts[c];
+				blocks[b].counts[c] = totals[c];
+				totals[c] += n;
+			}
+		}
+
+		starts[0] = 1;
+		for (int c=0; c<4; ++c) starts[c+1] = starts[c] + totals[c];
+	}
+
+	private: static void* thread_exec_fill(void* param)
+	{
+		Fill* f = static_cast<Fill*>(param);
+		f->index->fill_blocks(*f);
+		return NULL;
+	}
+
+	//Fill the BWT characters, samples and base counts of a range of blocks
+	private: void fill_blocks(const Fill& f)
+	{
+		const string& text = *(f.text);
+		const vector<SuffixSort::Index>& sa = *(f.sa);
+		long rows = text.size();
+
+		for (long r = f.first * BLOCK, end = min(rows, f.last * BLOCK); r < end; ++r)
+		{
+			Block& b = blocks[r / BLOCK];
+
+			if (r % sa_rate == 0)
+			{
+				samples[r / sa_rate] = sa[r];
+			}
+
+			//The character before the suffix (the terminator is stored as an A and corrected in rank)
+			if (sa[r] == 0)
+			{
+				primary = r;
+				continue;
+			}
+			int c = code(text[sa[r] - 1]);
+			b.bits[(r % BLOCK) / 32] |= (unsigned long long)c << (2 * (r % 32));
+			b.counts[c]++;
+		}
+	}
+
+	//The range of every row
+	public: Range all()
+	{
+		Range r = { 0, length + 1 };
+		return r;
+	}
+
+	//The BWT character of a row (the '$' row reads as A)
+	public: inline int base(long row)
+	{
+		return (blocks[row / BLOCK].bits[(row % BLOCK) / 32] >> (2 * (row % 32))) & 3;
+	}
+
+	//Number of occurrences of a base in the BWT rows [0, row)
+	public: inline long rank(int c, long row)
+	{
+		const Block& b = blocks[row / BLOCK];
+		const unsigned long long pattern = (unsigned long long)c * 0x5555555555555555ULL;
+
+		long n = b.counts[c];
+		int rest = row % BLOCK;
+
+		for (int w=0; rest > 0; ++w, rest -= 32)
+		{
+			//A 1 in the low bit of each base that equals c
+			unsigned long long x = ~(b.bits[w] ^ pattern);
+			x &= (x >> 1) & 0x5555555555555555ULL;
+
+			if (rest < 32) x &= (1ULL << (2 * rest)) - 1;
+			n += __builtin_popcountll(x);
+		}
+
+		//The '$' row was counted as an A if it is in this block (the checkpoints never count it)
+		if (c == 0 && primary < row && primary >= row - row % BLOCK) n--;
+		return n;
+	}
+
+	//Narrow a range of rows that start with a pattern to the rows that start with base + pattern
+	public: inline Range extend(Range r, int c)
+	{
+		Range out = { starts[c] + rank(c, r.lo), starts[c] + rank(c, r.hi) };
+		return out;
+	}
+
+	//Find the rows that start with a pattern (empty if it does not occur)
+	public: Range find(const string& pattern)
+	{
+		Range r = all();
+
+		for (int i=pattern.size()-1; i>=0 && !r.empty(); --i)
+		{
+			int c = code(pattern[i]);
+
+			if (c == -1)
+			{
+				r.hi = r.lo;
+				break;
+			}
+			r = extend(r, c);
+		}
+		return r;
+	}
+
+	//Number of occurrences of a pattern
+	public: long count(const string& pattern)
+	{
+		return find(pattern).size();
+	}
+
+	//The text position of a row
+	public: long locate(long row)
+	{
+		long steps = 0;
+
+		while (row % sa_rate != 0)
+		{
+			if (row == primary) return steps;
+
+			int c = base(row);
+			row = starts[c] + rank(c, row);
+			steps++;
+		}
+		return samples[row / sa_rate] + steps;
+	}
+
+	//Save the index to disk
+	public: bool save(string outfile)
+	{
+		ofstream out (outfile.c_str(), ios::binary);
+
+		if (!out.good())
+		{
+			cerr << "Unable to write FM-index: " << outfile << endl;
+			return false;
+		}
+		save(out);
+		out.close();
+		return true;
+	}
+
+	//Write the index to an open stream
+	public: void save(ostream& out)
+	{
+		long header[5] = { VERSION, length, primary, sa_rate, (long)blocks.size() };
+
+		out.write("RSLAMFMI", 8);
+		out.write((const char*)header, sizeof(header));
+		out.write((const char*)starts, sizeof(starts));
+		out.write((const char*)&(blocks[0]), blocks.size() * sizeof(Block));
+		out.write((const char*)&(samples[0]), samples.size() * sizeof(unsigned int));
+	}
+
+	//Load an index saved with save()
+	public: bool load(string infile)
+	{
+		ifstream in (infile.c_str(), ios::binary);
+
+		if (!load(in))
+		{
+			cerr << "Not an FM-index (or an unsupported version or truncated): " << infile << endl;
+			return false;
+		}
+		return true;
+	}
+
+	//Read an index from an open stream
+	public: bool load(istream& in)
+	{
+		clear();
+
+		char magic[8];
+		long header[5];
+
+		if (!in.read(magic, 8) || memcmp(magic, "RSLAMFMI", 8) != 0 || !in.read((char*)header, sizeof(header)) || header[0] != VERSION)
+		{
+			return false;
+		}
+		length  = header[1];
+		primary = header[2];
+		sa_rate = header[3];
+
+		blocks.resize(header[4]);
+		samples.resize((length + sa_rate) / sa_rate);
+
+		in.read((char*)starts, sizeof(starts));
+		in.read((char*)&(blocks[0]), blocks.size() * sizeof(Block));
+		in.read((char*)&(samples[0]), samples.size() * sizeof(unsigned int));
+
+		if (!in)
+		{
+			clear();
+			return false;
+		}
+		return true;
+	}
+};
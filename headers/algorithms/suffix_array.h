@@ -0,0 +1,426 @@
+/*
+ * Linear time suffix array construction by induced sorting (SA-IS, Nong, Zhang & Chan 2009)
+ *
+ * Works on any integer alphabet, so the same code sorts DNA (5 letters with the
+ * terminator), bytes (257 with the terminator) and the reduced strings of its
+ * own recursion. Indices are 32 bits, so a text can hold up to 4G-1 characters
+ * (a whole human genome fits). Memory is the text, 4 bytes per character for
+ * the suffix array, one bit per character for the suffix types and the bucket
+ * table; the recursion reuses the suffix array for its own text.
+ *
+ * With MIN_THREADS or more threads the suffixes are instead bucketed by their first
+ * few characters and the buckets are refined by prefix doubling (Manber-Myers),
+ * each round sorting the unresolved groups on a pool of threads. This needs
+ * 9 bytes per character (suffix array, ranks and group marks) but scales with
+ * the number of cores.
+ */
+#pragma once
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <algorithm>
+#include <pthread.h>
+
+using namespace std;
+
+struct SuffixSort
+{
+	typedef unsigned int Index;
+	static const Index EMPTY = 0xFFFFFFFFu;
+	static const int MIN_THREADS = 4; //Fewer threads than this and SA-IS is faster than parallel doubling
+
+	//Sort the suffixes of s[0..n). s[n-1] must be 0 and the only 0, and every character must be < K
+	template <class T>
+	static void sais(const T* s, Index* sa, Index n, Index K)
+	{
+		if (n == 1)
+		{
+			sa[0] = 0;
+			return;
+		}
+
+		//Suffix types (true for S, false for L)
+		vector<bool> types (n, false);
+		types[n-1] = true;
+
+		for (Index i=n-1; i-- > 0; )
+		{
+			types[i] = s[i] < s[i+1] || (s[i] == s[i+1] && types[i+1]);
+		}
+
+		vector<Index> buckets (K);
+
+		//Stage 1: place the LMS suffixes at the ends of their buckets and induce a sort of the LMS substrings
+		bucket_ends(s, n, buckets, true);
+
+		for (Index i=0; i<n; ++i) sa[i] = EMPTY;
+
+		for (Index i=1; i<n; ++i)
+		{
+			if (is_lms(types, i)) sa[--buckets[s[i]]] = i;
+		}
+		induce(s, sa, n, types, buckets);
+
+		//Compact the sorted LMS substrings into the front of the array
+		Index n1 = 0;
+
+		for (Index i=0; i<n; ++i)
+		{
+			if (is_lms(types, sa[i])) sa[n1++] = sa[i];
+		}
+
+		//Name the LMS substrings (equal substrings share a name). Names are stored by position/2 after the sorted list
+		for (Index i=n1; i<n; ++i) sa[i] = EMPTY;
+
+		Index names = 0;
+		Index prev = EMPTY;
+
+		for (Index i=0; i<n1; ++i)
+		{
+			Index pos = sa[i];
+			bool diff = false;
+
+			for (Index d=0; d<n; ++d)
+			{
+				if (prev == EMPTY || s[pos+d] != s[prev+d] || types[pos+d] != types[prev+d])
+				{
+					diff = true;
+					break;
+				}
+				if (d > 0 && (is_lms(types, pos+d) || is_lms(types, prev+d))) break;
+			}
+			if (diff)
+			{
+				names++;
+				prev = pos;
+			}
+			sa[n1 + pos/2] = names - 1;
+		}
+		for (Index i=n, j=n; i-- > n1; )
+		{
+			if (sa[i] != EMPTY) sa[--j] = sa[i];
+		}
+
+		//Stage 2: sort the reduced string (recursively, unless every name is unique)
+		Index* sa1 = sa;
+		Index* s1 = sa + n - n1;
+
+		if (names < n1)
+		{
+			sais(s1, sa1, n1, names);
+		}
+		else
+		{
+			for (Index i=0; i<n1; ++i) sa1[s1[i]] = i;
+		}
+
+		//Stage 3: place the sorted LMS suffixes and induce the rest
+		for (Index i=1, j=0; i<n; ++i)
+		{
+			if (is_lms(types, i)) s1[j++] = i;
+		}
+		for (Index i=0; i<n1; ++i) sa1[i] = s1[sa1[i]];
+		for (Index i=n1; i<n; ++i) sa[i] = EMPTY;
+
+		bucket_ends(s, n, buckets, true);
+
+		for (Index i=n1; i-- > 0; )
+		{
+			Index j = sa[i];
+			sa[i] = EMPTY;
+			sa[--buckets[s[j]]] = j;
+		}
+		induce(s, sa, n, types, buckets);
+	}
+
+	//Suffix array of a DNA text (anything but A, C, G or T sorts as T). The empty suffix is included, so
+	//sa has one more entry than the text and the first is always its length (as for a '$' terminated text)
+	static void sort_dna(const string& text, vector<Index>& sa, int threads = 1)
+	{
+		Index n = text.size() + 1;
+		vector<unsigned char> s (n, 0);
+
+		for (Index i=0; i+1<n; ++i)
+		{
+			switch (text[i])
+			{
+				case 'A' : s[i] = 1; break;
+				case 'C' : s[i] = 2; break;
+				case 'G' : s[i] = 3; break;
+				default  : s[i] = 4; break;
+			}
+		}
+		sa.resize(n);
+
+		//The terminator is unique, so rotation order is suffix order and both sorters agree exactly
+		if (threads >= MIN_THREADS)
+		{
+			sort_cyclic(&(s[0]), &(sa[0]), n, 5, threads);
+		}
+		else
+		{
+			sais(&(s[0]), &(sa[0]), n, 5);
+		}
+	}
+
+	//Sorted order of the rotations of any string (as used by the Burrows-Wheeler transformation)
+	//Rotations are the first n suffixes of the string repeated twice. Identical rotations are ordered arbitrarily
+	static void sort_rotations(const string& str, vector<Index>& order, int threads = 1)
+	{
+		Index n = str.size();
+
+		if (threads >= MIN_THREADS)
+		{
+			order.resize(n);
+			if (n > 0) sort_cyclic((const unsigned char*)str.data(), &(order[0]), n, 256, threads);
+			return;
+		}
+
+		Index m = 2 * n + 1;
+		vector<unsigned short> s (m, 0);
+
+		for (Index i=0; i<n; ++i)
+		{
+			s[i] = s[i+n] = (unsigned char)str[i] + 1;
+		}
+		vector<Index> full (m);
+		sais(&(s[0]), &(full[0]), m, 257);
+
+		order.clear();
+		order.reserve(n);
+
+		for (Index i=0; i<m; ++i)
+		{
+			if (full[i] < n) order.push_back(full[i]);
+		}
+	}
+
+	//Shared state of a parallel prefix doubling sort
+	struct Doubling
+	{
+		Index n;
+		Index h;              //Characters already sorted on
+		Index* sa;
+		vector<Index> rank;   //Rank of each rotation (the first row of its group)
+		vector<char> heads;   //1 for the first row of each group
+		vector<Index> chunks; //Work units (row ranges that start at a group)
+		vector<char> states;  //Per chunk: 0 unsorted, 1 sorted this round (ranks still to update), 2 sorted
+		int phase;            //0 to split the groups, 1 to update the ranks
+		int next;             //Next chunk to take
+		long unsorted;        //Groups with more than one row
+	};
+
+	//Orders rotations by the rank of the rotation h characters along
+	struct ByNext
+	{
+		const Index* rank;
+		Index h, n;
+
+		inline Index key(Index i) const
+		{
+			i += h;
+			return rank[i >= n ? i - n : i];
+		}
+		bool operator() (Index a, Index b) const
+		{
+			return key(a) < key(b);
+		}
+	};
+
+	//Sort the rotations of s[0..n) (every character must be < K) using a number of threads
+	static void sort_cyclic(const unsigned char* s, Index* sa, Index n, Index K, int threads)
+	{
+		Doubling d;
+		d.n = n;
+		d.sa = sa;
+		d.rank.resize(n);
+		d.heads.assign(n, 0);
+
+		//Bucket by the first k characters (a counting sort, with no more buckets than rotations)
+		Index k = 1;
+		Index buckets = K;
+
+		while (k < n && buckets <= n / K && buckets <= (1u << 24) / K)
+		{
+			buckets *= K;
+			k++;
+		}
+		Index key = 0;
+
+		for (Index j=0; j<k; ++j)
+		{
+			key = key * K + s[j % n];
+		}
+		for (Index i=0; i<n; ++i)
+		{
+			d.rank[i] = key;
+			key = (key % (buckets / K)) * K + s[(i + k) % n];
+		}
+
+		vector<Index> starts (buckets + 1, 0);
+
+		for (Index i=0; i<n; ++i) starts[d.rank[i] + 1]++;
+		for (Index b=0; b<buckets; ++b) starts[b+1] += starts[b];
+		for (Index i=0; i<n; ++i) sa[starts[d.rank[i]]++] = i;
+
+		vector<Index>().swap(starts);
+
+		d.unsorted = 0;
+
+		for (Index j=0; j<n; ++j)
+		{
+			d.heads[j] = (j == 0 || d.rank[sa[j]] != d.rank[sa[j-1]]);
+
+			if (!d.heads[j] && d.heads[j-1]) d.unsorted++;
+		}
+		d.h = k;
+
+		//Many more chunks than threads, so a large group in one chunk does not hold everything up
+		Index step = max<Index>(n / (64 * threads), 4096);
+
+		for (Index j=0; j<n; )
+		{
+			d.chunks.push_back(j);
+
+			for (j = (n - j > step) ? j + step : n; j < n && !d.heads[j]; ++j);
+		}
+		d.chunks.push_back(n);
+		d.states.assign(d.chunks.size() - 1, 0);
+
+		run(d, 1, threads);
+
+		//Double the sorted prefix until every group is a single rotation (or the rest are identical rotations)
+		while (d.unsorted > 0 && d.h < n)
+		{
+			d.unsorted = 0;
+			run(d, 0, threads);
+			run(d, 1, threads);
+			d.h = (d.h < n / 2) ? 2 * d.h : n;
+		}
+	}
+
+	//Run one phase of a doubling round over the chunks that are not yet sorted
+	private: static void run(Doubling& d, int phase, int threads)
+	{
+		d.phase = phase;
+		d.next = 0;
+
+		vector<pthread_t> pool (threads);
+
+		for (int t=0; t<threads; ++t)
+		{
+			pthread_create(&(pool[t]), NULL, thread_exec, &d);
+		}
+		for (int t=0; t<threads; ++t)
+		{
+			pthread_join(pool[t], NULL);
+		}
+	}
+
+	//Take chunks until there are none left
+	private: static void* thread_exec(void* param)
+	{
+		Doubling& d = *static_cast<Doubling*>(param);
+		int last = d.chunks.size() - 1;
+
+		for (int c = __sync_fetch_and_add(&d.next, 1); c < last; c = __sync_fetch_and_add(&d.next, 1))
+		{
+			if (d.states[c] == 2) continue;
+
+			if (d.phase == 0)
+			{
+				if (split(d, d.chunks[c], d.chunks[c+1]) == 0) d.states[c] = 1;
+			}
+			else
+			{
+				for (Index j=d.chunks[c], group=j; j<d.chunks[c+1]; ++j)
+				{
+					if (d.heads[j]) group = j;
+					d.rank[d.sa[j]] = group;
+				}
+				if (d.states[c] == 1) d.states[c] = 2;
+			}
+		}
+		return NULL;
+	}
+
+	//Sort each group of rows[a..b) by the next h characters and mark where the new groups start
+	//Only rows within the range are written, and ranks are only read, so chunks run independently
+	//Returns the number of groups still unsorted
+	private: static long split(Doubling& d, Index a, Index b)
+	{
+		ByNext next = { &(d.rank[0]), d.h, d.n };
+		long unsorted = 0;
+
+		for (Index j=a, end; j<b; j=end)
+		{
+			for (end=j+1; end<b && !d.heads[end]; ++end);
+
+			if (end - j == 1) continue;
+
+			sort(d.sa + j, d.sa + end, next);
+
+			for (Index i=j+1; i<end; ++i)
+			{
+				if (next.key(d.sa[i]) != next.key(d.sa[i-1]))
+				{
+					d.heads[i] = 1;
+				}
+				else if (d.heads[i-1])
+				{
+					unsorted++;
+				}
+			}
+		}
+		if (unsorted > 0) __sync_fetch_and_add(&d.unsorted, unsorted);
+		return unsorted;
+	}
+
+	//A leftmost S-type position (S-type with an L-type before it)
+	private: static inline bool is_lms(const vector<bool>& types, Index i)
+	{
+		return i != EMPTY && i > 0 && types[i] && !types[i-1];
+	}
+
+	//Bucket starts or ends for each character
+	private: template <class T>
+	static void bucket_ends(const T* s, Index n, vector<Index>& buckets, bool ends)
+	{
+		Index K = buckets.size();
+
+		for (Index i=0; i<K; ++i) buckets[i] = 0;
+		for (Index i=0; i<n; ++i) buckets[s[i]]++;
+
+		for (Index i=0, sum=0; i<K; ++i)
+		{
+			sum += buckets[i];
+			buckets[i] = ends ? sum : sum - buckets[i];
+		}
+	}
+
+	//Induce the L-type suffixes from the left, then the S-type suffixes from the right
+	private: template <class T>
+	static void induce(const T* s, Index* sa, Index n, const vector<bool>& types, vector<Index>& buckets)
+	{
+		bucket_ends(s, n, buckets, false);
+
+		for (Index i=0; i<n; ++i)
+		{
+			if (sa[i] == EMPTY || sa[i] == 0) continue;
+
+			Index j = sa[i] - 1;
+			if (!types[j]) sa[buckets[s[j]]++] = j;
+		}
+
+		bucket_ends(s, n, buckets, true);
+
+		for (Index i=n; i-- > 0; )
+		{
+			if (sa[i] == EMPTY || sa[i] == 0) continue;
+
+			Index j = sa[i] - 1;
+			if (types[j]) sa[--buckets[s[j]]] = j;
+		}
+	}
+};
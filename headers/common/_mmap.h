@@ -0,0 +1,92 @@
+#pragma once
+
+#include "_common.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/*
+ * Read-only memory mapping of a file
+ * Pages are shared through the page cache, so many processes mapping the same
+ * file only hold one copy of it in RAM
+ */
+namespace ReadSlam
+{
+	struct MemoryMap
+	{
+		string filename;
+		char*  data;
+		size_t size;
+		int    fd;
+
+		 MemoryMap() { data = NULL; size = 0; fd = -1; }
+		~MemoryMap() { close(); }
+
+		//Map a file into memory. Returns false if the file could not be mapped
+		bool open(string infile)
+		{
+			close();
+
+			fd = ::open(infile.c_str(), O_RDONLY);
+
+			if (fd == -1)
+			{
+				cerr << "Error: unable to open file " << infile << endl;
+				return false;
+			}
+
+			struct stat info;
+
+			if (fstat(fd, &info) == -1 || info.st_size == 0)
+			{
+				cerr << "Error: unable to determine the size of file " << infile << endl;
+				close();
+				return false;
+			}
+			size = info.st_size;
+
+			void* p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+
+			if (p == MAP_FAILED)
+			{
+				cerr << "Error: unable to map file " << infile << endl;
+				size = 0;
+				close();
+				return false;
+			}
+			data = (char*)p;
+			filename = infile;
+			return true;
+		}
+
+		//Hint that a region of the map will be needed soon (eg. the key tables)
+		void prefetch(size_t offset, size_t bytes)
+		{
+			if (data == NULL || offset >= size) return;
+
+			//madvise requires a page aligned start
+			size_t page = sysconf(_SC_PAGESIZE);
+			size_t start = offset - (offset % page);
+
+			madvise(data + start, bytes + (offset - start), MADV_WILLNEED);
+		}
+
+		//Release the mapping
+		void close()
+		{
+			if (data != NULL)
+			{
+				munmap(data, size);
+			}
+			if (fd != -1)
+			{
+				::close(fd);
+			}
+			filename.clear();
+			data = NULL;
+			size = 0;
+			fd = -1;
+		}
+	};
+}
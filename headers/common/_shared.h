@@ -0,0 +1,340 @@
+#pragma once
+
+#include "_common.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+
+/*
+ * A named POSIX shared memory segment that is written once by the process that
+ * creates it and then used read-only by every process that attaches to it.
+ *
+ * The first page holds a small control block (readiness flag and a slot per
+ * attached process). The segment is not removed when its last user detaches,
+ * so the next job can attach straight away; call SharedMemory::remove to free it.
+ *
+ * A second segment (the name with ".lock" added) is locked while the segment is
+ * built: exclusively by its creator, and shared by a process attaching to it, so
+ * nobody can see a segment that is half made. The lock goes with the process that
+ * holds it, so a creator that dies leaves an unfinished segment (not ready) that
+ * the next creator replaces, and users that die are dropped when their slot is
+ * found to belong to a process that no longer exists.
+ * Both segments are created readable and writable by everyone (whatever the umask),
+ * since a process attaching to them writes its slot and flocks the lock.
+ * Link with -lrt on older glibc.
+ */
+namespace ReadSlam
+{
+	struct SharedMemory
+	{
+		static const int MAGIC = 0x52534d32; //"RSM2"
+		static const int MAX_USERS = 960;
+		static const int TIMEOUT = 4 * 3600; //Longest wait (seconds) for another process to build a segment
+		static const mode_t MODE = 0666; //Other users on the node attach to the segments too
+
+		struct Control
+		{
+			int magic;
+			volatile int ready;
+			long long size;
+			volatile int users[MAX_USERS]; //Process ids of the attached processes (0 is a free slot)
+		};
+
+		string   name;
+		Control* control;
+		char*    data;
+		size_t   size;
+		size_t   page;
+		bool     owner;
+		int      slot;
+		int      lock_fd;
+
+		 SharedMemory() { control = NULL; data = NULL; size = 0; owner = false; slot = -1; lock_fd = -1; page = sysconf(_SC_PAGESIZE); }
+		~SharedMemory() { close(); }
+
+		//Segment names must start with a slash and contain no others
+		static string segment(string name)
+		{
+			Strings::replace(name, "/", "_");
+			return "/readslam." + name;
+		}
+
+		//Create a new segment of the given size to build in. The build lock is held until publish, so other processes
+		//wait for the segment rather than building their own. Returns false if another process published it first
+		bool create(string name, size_t bytes)
+		{
+			close();
+			lock(name, LOCK_EX);
+
+			string path = segment(name);
+
+			if (published(name))
+			{
+				unlock();
+				return false;
+			}
+
+			//Anything left under the name is a segment whose creator died before publishing it
+			shm_unlink(path.c_str());
+
+			int fd = shm_open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, MODE);
+
+			if (fd == -1)
+			{
+				cerr << "Error: unable to create shared memory segment " << path << endl;
+				exit(1);
+			}
+			fchmod(fd, MODE);
+
+			if (ftruncate(fd, page + bytes) == -1)
+			{
+				cerr << "Error: unable to allocate " << (bytes / 1000000) << "MB of shared memory for " << path << endl;
+				::close(fd);
+				shm_unlink(path.c_str());
+				exit(1);
+			}
+			void* c = mmap(NULL, page, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			void* d = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, page);
+			::close(fd);
+
+			if (c == MAP_FAILED || d == MAP_FAILED)
+			{
+				cerr << "Error: unable to map shared memory segment " << path << endl;
+				shm_unlink(path.c_str());
+				exit(1);
+			}
+			this->name = name;
+			this->control = (Control*)c;
+			this->data = (char*)d;
+			this->size = bytes;
+			this->owner = true;
+
+			control->magic = MAGIC;
+			control->size = bytes;
+			control->ready = 0;
+			join();
+			return true;
+		}
+
+		//Mark the segment as complete and let the waiting processes in. The data becomes read-only for the creator too
+		void publish()
+		{
+			if (!owner) return;
+
+			mprotect(data, size, PROT_READ);
+			__sync_synchronize();
+			control->ready = 1;
+			unlock();
+		}
+
+		//Attach to a published segment read-only, waiting while another process builds it. Returns false if there is
+		//no published segment
+		bool attach(string name)
+		{
+			close();
+			lock(name, LOCK_SH);
+
+			string path = segment(name);
+
+			if (!published(name))
+			{
+				unlock();
+				return false;
+			}
+			int fd = shm_open(path.c_str(), O_RDWR, 0);
+
+			if (fd == -1)
+			{
+				cerr << "Error: unable to open shared memory segment " << path << endl;
+				exit(1);
+			}
+			void* c = mmap(NULL, page, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+			if (c == MAP_FAILED)
+			{
+				cerr << "Error: unable to map shared memory segment " << path << endl;
+				exit(1);
+			}
+			control = (Control*)c;
+			__sync_synchronize();
+
+			void* d = mmap(NULL, control->size, PROT_READ, MAP_SHARED, fd, page);
+			::close(fd);
+
+			if (d == MAP_FAILED)
+			{
+				cerr << "Error: unable to map shared memory segment " << path << endl;
+				exit(1);
+			}
+			this->name = name;
+			this->data = (char*)d;
+			this->size = control->size;
+			this->owner = false;
+			join();
+			unlock();
+			return true;
+		}
+
+		//Detach from the segment (the segment itself stays until removed)
+		void close()
+		{
+			if (data != NULL)
+			{
+				munmap(data, size);
+			}
+			if (control != NULL)
+			{
+				if (slot != -1) __sync_bool_compare_and_swap(&(control->users[slot]), (int)getpid(), 0);
+				munmap(control, page);
+			}
+			unlock();
+			name.clear();
+			control = NULL;
+			data = NULL;
+			size = 0;
+			owner = false;
+			slot = -1;
+		}
+
+		//Number of live processes attached to a segment, or -1 if it does not exist
+		static int users(string name)
+		{
+			SharedMemory shm;
+			int fd = shm_open(segment(name).c_str(), O_RDONLY, 0);
+
+			if (fd == -1) return -1;
+
+			struct stat info;
+
+			if (fstat(fd, &info) == -1 || info.st_size < (off_t)shm.page)
+			{
+				::close(fd);
+				return 0;
+			}
+			void* c = mmap(NULL, shm.page, PROT_READ, MAP_SHARED, fd, 0);
+			::close(fd);
+
+			if (c == MAP_FAILED) return -1;
+
+			int count = 0;
+
+			for (int i=0; i<MAX_USERS; ++i)
+			{
+				count += alive(((Control*)c)->users[i]);
+			}
+			munmap(c, shm.page);
+			return count;
+		}
+
+		//Remove a segment. Refuses while processes are attached unless forced
+		static bool remove(string name, bool force)
+		{
+			int count = users(name);
+
+			if (count == -1)
+			{
+				cerr << "No shared memory segment named " << segment(name) << endl;
+				return false;
+			}
+			if (count > 0 && !force)
+			{
+				cerr << "Shared memory segment " << segment(name) << " is still used by " << count << " process(es)" << endl;
+				return false;
+			}
+			shm_unlink((segment(name) + ".lock").c_str());
+			return shm_unlink(segment(name).c_str()) == 0;
+		}
+
+		//Whether a process id belongs to a running process
+		private: static bool alive(int pid)
+		{
+			return pid > 0 && (kill(pid, 0) == 0 || errno == EPERM);
+		}
+
+		//Whether a complete segment is published under a name (only asked with the build lock held)
+		private: bool published(string name)
+		{
+			int fd = shm_open(segment(name).c_str(), O_RDONLY, 0);
+
+			if (fd == -1) return false;
+
+			struct stat info;
+			bool ready = false;
+
+			if (fstat(fd, &info) == 0 && info.st_size >= (off_t)page)
+			{
+				void* c = mmap(NULL, page, PROT_READ, MAP_SHARED, fd, 0);
+
+				if (c != MAP_FAILED)
+				{
+					ready = ((Control*)c)->magic == MAGIC && ((Control*)c)->ready;
+					munmap(c, page);
+				}
+			}
+			::close(fd);
+			return ready;
+		}
+
+		//Take a slot in the control block, reusing those of processes that have died
+		private: void join()
+		{
+			int pid = getpid();
+
+			for (int i=0; i<MAX_USERS; ++i)
+			{
+				int user = control->users[i];
+
+				if ((user == 0 || (user != pid && !alive(user))) && __sync_bool_compare_and_swap(&(control->users[i]), user, pid))
+				{
+					slot = i;
+					return;
+				}
+			}
+			cerr << "Error: more than " << MAX_USERS << " processes are attached to shared memory segment " << segment(name) << endl;
+			exit(1);
+		}
+
+		//Take the build lock of a segment (LOCK_EX to build it, LOCK_SH to attach to it), waiting up to TIMEOUT seconds
+		private: void lock(string name, int mode)
+		{
+			string path = segment(name) + ".lock";
+
+			lock_fd = shm_open(path.c_str(), O_RDWR | O_CREAT, MODE);
+
+			if (lock_fd == -1)
+			{
+				cerr << "Error: unable to open shared memory lock " << path << endl;
+				exit(1);
+			}
+			fchmod(lock_fd, MODE); //Fails harmlessly when another user created the lock
+
+			if (flock(lock_fd, mode | LOCK_NB) == 0) return;
+
+			cout << "Waiting for shared index " << segment(name) << " to be built by another process..." << flush;
+
+			for (int waited=0; flock(lock_fd, mode | LOCK_NB) != 0; ++waited)
+			{
+				if (waited == TIMEOUT)
+				{
+					cerr << endl << "Error: timed out waiting for shared memory segment " << segment(name) << endl;
+					exit(1);
+				}
+				sleep(1);
+			}
+			cout << "done" << endl;
+		}
+
+		private: void unlock()
+		{
+			if (lock_fd == -1) return;
+
+			flock(lock_fd, LOCK_UN);
+			::close(lock_fd);
+			lock_fd = -1;
+		}
+	};
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "_common.h"
+#include <sys/time.h>
 
 /*
  * Simple routines for determining some basic system information
@@ -95,5 +96,13 @@ namespace ReadSlam
 			cerr << "Unable to determine available RAM, defaulting to 1000 MB" << endl;
 			return 1000;
 		}
+		
+		//Wall clock time in seconds, for timing runs
+		static double seconds()
+		{
+			timeval now;
+			gettimeofday(&now, NULL);
+			return now.tv_sec + now.tv_usec / 1e6;
+		}
 	};
 }
@@ -7,6 +7,9 @@ namespace ReadSlam
 {
 	struct Assembly
 	{
+		//The bases (2 bits each). Both strands read through this
+		PackedSequence reference;
+
 		Sequence forward;
 		Sequence reverse;
 		
@@ -15,40 +18,93 @@ namespace ReadSlam
 		
 		 Assembly() { clear(); }
 		~Assembly() { clear(); }
+		
+		//Copies must point their strands at their own reference
+		Assembly(const Assembly& other) { *this = other; }
+		
+		Assembly& operator= (const Assembly& other)
+		{
+			reference = other.reference;
+			forward = other.forward;
+			reverse = other.reverse;
+			name = other.name;
+			length = other.length;
+			
+			if (forward.reference != NULL) forward.reference = &reference;
+			if (reverse.reference != NULL) reverse.reference = &reference;
+			return *this;
+		}
 
 		void clear()
 		{
 			forward.clear();
 			reverse.clear();
+			reference.clear();
 			name.clear();
 			length = 0;
 		}
 			
 		void init(string name, string sequence)
+		{
+			PackedSequence packed;
+			packed.assign(sequence);
+			init(name, packed);
+		}
+		
+		//Take ownership of an already packed sequence (the argument is left empty)
+		void init(string name, PackedSequence& packed)
 		{
 			this->name = name;
-			this->length = sequence.size();
-			forward.init(name, true, sequence);
-			reverse.init(name, false, sequence);
+			this->length = packed.length;
+			reference.swap(packed);
+			forward.init(name, true, &reference);
+			reverse.init(name, false, &reference);
 		}
 		
-		void build_index(int seed, bool bisulfite, bool usemap)
+		//A compressed vector index codes each strand's positions as soon as it is built (see Sequence::compress)
+		//With a window only the minimizers are put in the vector index (see DNA::minimizers)
+		void build_index(int seed, bool bisulfite, bool usemap, bool sparse = false, bool single = false, int threads = 1, bool compressed = false, int window = 0)
 		{
-			if (usemap)
+			//Only the forward strand is indexed; the reverse strand is searched with reverse complemented reads
+			if (single)
+			{
+				bool ry = bisulfite;
+				
+				if (sparse) forward.build_index_sparse(seed, bisulfite, ry);
+				else if (usemap) forward.build_index_map(seed, bisulfite, ry);
+				else
+				{
+					forward.build_index(seed, bisulfite, ry, threads, window);
+					if (compressed) forward.compress();
+				}
+				
+				reverse.bisulfite = bisulfite;
+				return;
+			}
+			if (sparse)
+			{
+				forward.build_index_sparse(seed, bisulfite);
+				reverse.build_index_sparse(seed, bisulfite);
+			}
+			else if (usemap)
 			{
 				forward.build_index_map(seed, bisulfite);
 				reverse.build_index_map(seed, bisulfite);
 			}
 			else
 			{
-				forward.build_index(seed, bisulfite);
-				reverse.build_index(seed, bisulfite);
+				forward.build_index(seed, bisulfite, false, threads, window);
+				if (compressed) forward.compress();
+				
+				reverse.build_index(seed, bisulfite, false, threads, window);
+				if (compressed) reverse.compress();
 			}
 		}
 		void close()
 		{
 			forward.clear();
 			reverse.clear();
+			reference.clear();
 		}
 	};
 }
@@ -4,12 +4,23 @@
 #include <vector>
 #include <cmath>
 #include <iostream>
+#include <cstdlib>
+#include <algorithm>
+#include <immintrin.h>
 
 using namespace std;
 
 //Static functions
 namespace DNA
 {
+	//A k-mer of up to 32 bases packed 2 bits per base
+	typedef unsigned long long Kmer;
+	
+	//Marks positions that have no k-mer (an N within the seed, or too close to the end)
+	//Note: with a seed of 32 the all-T k-mer shares this value and is never indexed
+	static const Kmer NO_KMER = ~0ULL;
+	static const int  MAX_KMER = 32;
+
 	//Clean a DNA string
 	void clean (string& dna)
 	{
@@ -80,6 +91,33 @@ namespace DNA
 		return out;
 	}
 	
+	//Reverse complement a buffer of DNA in place
+	void reverse_complement (char* dna, long len)
+	{
+		for (long i=0, j=len-1; i<=j; ++i, --j)
+		{
+			char a = dna[i];
+			char b = dna[j];
+			
+			switch (b)
+			{
+				case 'A' : dna[i] = 'T'; break;
+				case 'T' : dna[i] = 'A'; break;
+				case 'C' : dna[i] = 'G'; break;
+				case 'G' : dna[i] = 'C'; break;
+				default  : dna[i] = 'N';
+			}
+			switch (a)
+			{
+				case 'A' : dna[j] = 'T'; break;
+				case 'T' : dna[j] = 'A'; break;
+				case 'C' : dna[j] = 'G'; break;
+				case 'G' : dna[j] = 'C'; break;
+				default  : dna[j] = 'N';
+			}
+		}
+	}
+	
 	//Convert a sequence to a bisulfite sequence
 	string bisulfite (const string& dna)
 	{
@@ -95,8 +133,130 @@ namespace DNA
 		return out;
 	}
 	
+	//Base codes for the k-mer encoders: A=0, C=1, G=2, T=3 (C reads as T in bisulfite mode), anything else NO_BASE
+	//In the purine/pyrimidine alphabet a base is its code's low bit (A,G = 0 and C,T = 1)
+	static const unsigned char NO_BASE = 4;
+	
+	struct BaseCodes
+	{
+		unsigned char plain[256];
+		unsigned char bs[256];
+		
+		BaseCodes()
+		{
+			for (int i=0; i<256; ++i)
+			{
+				plain[i] = NO_BASE;
+				bs[i] = NO_BASE;
+			}
+			plain['A'] = 0; plain['C'] = 1; plain['G'] = 2; plain['T'] = 3;
+			bs['A'] = 0;    bs['C'] = 3;    bs['G'] = 2;    bs['T'] = 3;
+		}
+	};
+	static const BaseCodes base_codes;
+	
+	//Translate bases to codes through the table
+	static void encode_scalar(const char* seq, long length, unsigned char* codes, bool bs)
+	{
+		const unsigned char* table = bs ? base_codes.bs : base_codes.plain;
+		
+		for (long i=0; i<length; ++i)
+		{
+			codes[i] = table[(unsigned char)seq[i]];
+		}
+	}
+	
+	//Translate 32 bases at a time: each code is built from the byte compares against A, C, G and T, and bytes
+	//matching none of them become NO_BASE
+	__attribute__((target("avx2")))
+	static void encode_avx2(const char* seq, long length, unsigned char* codes, bool bs)
+	{
+		const __m256i as = _mm256_set1_epi8('A');
+		const __m256i cs = _mm256_set1_epi8('C');
+		const __m256i gs = _mm256_set1_epi8('G');
+		const __m256i ts = _mm256_set1_epi8('T');
+		const __m256i c_code = _mm256_set1_epi8(bs ? 3 : 1);
+		const __m256i g_code = _mm256_set1_epi8(2);
+		const __m256i t_code = _mm256_set1_epi8(3);
+		const __m256i none = _mm256_set1_epi8(NO_BASE);
+		
+		long i = 0;
+		
+		for (; i + 32 <= length; i += 32)
+		{
+			__m256i b = _mm256_loadu_si256((const __m256i*)(seq + i));
+			__m256i is_a = _mm256_cmpeq_epi8(b, as);
+			__m256i is_c = _mm256_cmpeq_epi8(b, cs);
+			__m256i is_g = _mm256_cmpeq_epi8(b, gs);
+			__m256i is_t = _mm256_cmpeq_epi8(b, ts);
+			
+			__m256i code = _mm256_or_si256(_mm256_and_si256(is_c, c_code), _mm256_or_si256(_mm256_and_si256(is_g, g_code), _mm256_and_si256(is_t, t_code)));
+			__m256i valid = _mm256_or_si256(_mm256_or_si256(is_a, is_c), _mm256_or_si256(is_g, is_t));
+			
+			_mm256_storeu_si256((__m256i*)(codes + i), _mm256_or_si256(code, _mm256_andnot_si256(valid, none)));
+		}
+		encode_scalar(seq + i, length - i, codes + i, bs);
+	}
+	
+	typedef void (*Encoder)(const char*, long, unsigned char*, bool);
+	
+	//Pick the encoder once for this CPU
+	static Encoder select_encoder()
+	{
+		__builtin_cpu_init();
+		
+		if (__builtin_cpu_supports("avx2")) return encode_avx2;
+		return encode_scalar;
+	}
+	
+	static inline void encode(const char* seq, long length, unsigned char* codes, bool bs)
+	{
+		static const Encoder encoder = select_encoder();
+		encoder(seq, length, codes, bs);
+	}
+	
+	//Roll a sequence into the keys of the seeds starting at each position (bits per base: 2, or 1 for the
+	//purine/pyrimidine alphabet). Bases are encoded a block at a time, then shifted into the key, with a count of
+	//the valid bases in a row standing in for a reset at each N. Seeds that run into an N or off the end get empty
+	template <typename Key>
+	void roll_keys(const string& seq, vector<Key>& keys, int seed, bool bs, int bits, Key empty)
+	{
+		static const long BLOCK = 4096;
+		
+		const Kmer mask = (bits * seed >= 64) ? ~0ULL : (1ULL << (bits * seed)) - 1;
+		const Kmer take = bits == 1 ? 1 : 3;
+		long length = seq.size();
+		
+		keys.clear();
+		keys.resize(length, empty);
+		
+		unsigned char codes[BLOCK];
+		Kmer key = 0;
+		int run = 0;
+		
+		for (long start=0; start<length; start+=BLOCK)
+		{
+			long n = min(BLOCK, length - start);
+			encode(seq.data() + start, n, codes, bs);
+			
+			for (long j=0; j<n; ++j)
+			{
+				Kmer code = codes[j];
+				
+				key = ((key << bits) | (code & take)) & mask;
+				run = (run + 1) & -(int)(code != NO_BASE);
+				run -= run > seed;
+				
+				if (run == seed)
+				{
+					keys[start + j - seed + 1] = (Key)key;
+				}
+			}
+		}
+	}
+	
 	//Generate indices for a sequence
-	void seq2indices(string& seq, vector<int>& indices, int seed, bool bs)
+	void seq2indices(const string& seq, vector<int>& indices, int seed, bool bs)
 	{
 		if (seed > 15)
 		{
@@ -104,41 +264,76 @@ namespace DNA
 			return;
 			//FIXME: should make a hard exit here. exit(1);
 		}
-		int base = 4;
-		int mask = (int)(pow((double)base,(double)seed) - 1);
-		int length = seq.size();
+		roll_keys(seq, indices, seed, bs, 2, -1);
+	}
 
-		indices.clear();
-		indices.resize(length, -1);
+	//Generate 64-bit keys for a sequence (seeds of up to 32 bases). Keys match seq2indices for seeds <= 15
+	void seq2keys(const string& seq, vector<Kmer>& keys, int seed, bool bs)
+	{
+		if (seed < 1 || seed > MAX_KMER)
+		{
+			cerr << "Seed size must be between 1 and " << MAX_KMER << endl;
+			exit(1);
+		}
+		roll_keys(seq, keys, seed, bs, 2, NO_KMER);
+	}
+
+	//Generate purine/pyrimidine keys for a sequence (A,G = 0 and C,T = 1, one bit per base)
+	//Bisulfite C->T on one strand is G->A on the other, so in this alphabet a bisulfite read and
+	//its reverse complement can both be looked up in a forward strand index
+	void seq2keys_ry(const string& seq, vector<Kmer>& keys, int seed)
+	{
+		if (seed < 1 || seed > MAX_KMER)
+		{
+			cerr << "Seed size must be between 1 and " << MAX_KMER << endl;
+			exit(1);
+		}
+		roll_keys(seq, keys, seed, false, 1, NO_KMER);
+	}
+
+	//The order minimizers are picked in. Keys are shuffled (an odd multiply and an xor shift can both be undone, so no
+	//two keys tie), otherwise low complexity k-mers like poly-A would be picked first wherever they occur
+	inline unsigned int minimizer_order(int key)
+	{
+		unsigned int h = (unsigned int)key * 0x9E3779B1U;
+		return h ^ (h >> 16);
+	}
+
+	//Keep only the (window, seed) minimizers of count keys, setting the others to -1: every window of consecutive
+	//positions keeps its key lowest in minimizer_order (the leftmost of equals), and positions without a key are never
+	//kept. A window holding the same keys in a read and in the genome keeps the same position in both, so a read's
+	//minimizers are indexed wherever a whole window of the read matches the genome exactly.
+	//The queue holds the positions of increasing order in the current window (a ring of window + 1)
+	void minimizers(int* keys, int count, int window, vector<int>& queue)
+	{
+		int size = window + 1;
+		if ((int)queue.size() < size) queue.resize(size);
 		
-		int index = 0;
-		int nbits = 0;
+		long head = 0;
+		long tail = 0;
+		int last = -1; //The last position kept. Those between it and the next one kept are cleared
 		
-		for (int i=0; i<length; i++)
+		for (int end=0; end<count; ++end)
 		{
-			switch (seq[i])
+			if (keys[end] != -1)
 			{
-				case 'A' : index <<= 2; break;
-				case 'C' : 
-					if (!bs)
-					{
-						index <<= 2; index++;
-					}
-					else
-					{
-						index <<= 1; index++; index <<= 1; index++;
-					}
-				break;
-				case 'G' : index <<= 1; index++; index <<= 1; break;
-				case 'T' : index <<= 1; index++; index <<= 1; index++; break;
-				default : nbits = 0; index = 0; continue;
-			}
-			if ((++nbits) == seed)
-			{
-				indices[i-(seed-1)] = index & mask;
-				nbits--;
+				unsigned int order = minimizer_order(keys[end]);
+				
+				while (tail > head && minimizer_order(keys[queue[(tail - 1) % size]]) > order) tail--;
+				queue[tail++ % size] = end;
 			}
+			int start = end - window + 1;
+			if (start < 0) continue;
+			
+			if (tail > head && queue[head % size] < start) head++;
+			if (tail == head || queue[head % size] == last) continue;
+			
+			int kept = queue[head % size];
+			
+			for (int i=last + 1; i<kept; ++i) keys[i] = -1;
+			last = kept;
 		}
+		for (int i=last + 1; i<count; ++i) keys[i] = -1;
 	}
 
 /*
@@ -1,7 +1,13 @@
 #pragma once
 
 #include "../common/_sysinfo.h"
+#include "../common/_mmap.h"
+#include "../common/_shared.h"
 #include "_assembly.h"
+#include "_index_file.h"
+#include "_index_global.h"
+#include "_read_queue.h"
+#include "_map_cache.h"
 #include "../parsing/_fastq.h"
 
 /**
@@ -14,6 +20,7 @@ namespace ReadSlam
 	struct Genome
 	{
 		vector<Assembly> assemblies;
+		map<string, int> assembly_ids; //Assemblies by name
 		Sysinfo system;
 		int num_assemblies;
 		long length;
@@ -21,13 +28,48 @@ namespace ReadSlam
 
 		bool index_built;
 		bool index_usemap;
+		bool index_sparse;
+		bool index_single; //Only the forward strands are indexed
+		bool index_global; //One vector index over all of the assemblies (see IndexGlobal), rather than one per assembly
+		bool index_compressed; //The vector index positions are Elias-Fano coded (see IndexCompressed)
+		int  index_window; //Only the minimizers of each window of this many positions are in the vector index (see DNA::minimizers)
 		int  index_seed;
 		
+		IndexGlobal global;
+		
+		//Seeds that occur more than repeat_threshold times on any indexed strand are only tried last, which bounds the
+		//cost of repetitive reads but may miss their best alignment (0, the default, turns this off)
+		RepeatMask repeats;
+		int repeat_threshold;
+		
+		//Reads mapped together by map_batch (0 maps them one at a time)
+		int batch_size;
+		
+		//Try each read for exact matches before the seed search (see map_exact)
+		bool exact_first;
+		
+		//Results of recently mapped sequences, reused by their duplicates (2^cache_bits slots, 0 turns this off)
+		MapCache cache;
+		int cache_bits;
+		
+		//Only unique alignments are wanted: a read stops at its second exact hit (see Read::settled)
+		bool unique_only;
+		
+		//Search with disjoint seeds, guaranteeing alignments with up to this many mismatches are found (0 searches the first seed that hits)
+		int pigeonhole;
+		
+		//Backing store when the index was loaded from disk or shared memory
+		MemoryMap index_file;
+		SharedMemory index_shared;
+		
 		//mapping counters
 		long mapped_total;
 		long mapped_unique;
 		long mapped_multi;
 		long mapped_failed;
+		long mapped_candidates; //Candidate positions verified
+		long mapped_exact;      //Reads resolved by the exact match pass
+		long mapped_cached;     //Reads that reused the result of an identical read
 
  		 Genome() { clear(); }
 		~Genome() { clear(); }
@@ -35,21 +77,41 @@ namespace ReadSlam
 		void clear()
 		{
 			assemblies.clear();
+			assembly_ids.clear();
 			num_assemblies = 0;
 			length = 0;
 			bisulfite = false;
 
 			index_built = false;
 			index_usemap = false;
+			index_sparse = false;
+			index_single = false;
+			index_global = false;
+			index_compressed = false;
+			index_window = 0;
 			index_seed = 0;
+			global.clear();
+			repeats.clear();
+			repeat_threshold = 0;
+			pigeonhole = 0;
+			unique_only = false;
+			batch_size = 16384;
+			exact_first = true;
+			cache.clear();
+			cache_bits = 18;
+			index_file.close();
+			index_shared.close();
 
 			mapped_total = 0;
 			mapped_unique = 0;
 			mapped_multi = 0;
 			mapped_failed = 0;
+			mapped_candidates = 0;
+			mapped_exact = 0;
+			mapped_cached = 0;
 		}
 		
-		//Load genome from a FastA file
+		//Load genome from a FastA file. Sequences are packed as they are read so the genome is never held as text
 		void load(string infile)
 		{
 			cout << endl;
@@ -62,34 +124,28 @@ namespace ReadSlam
 				cerr << "Error: unable to open reference file " << infile << endl;
 				exit(1);
 			}
-			ostringstream refseq;
-			refseq.clear();
-			
+			list<PackedSequence> packed;
 			vector<string> names;
-			vector<long> offsets;
-
+			
 			long offset = 0;
 			string line = "";
-
-			while (in.good())
+			
+			while (true)
 			{
-				getline(in, line);
-
-				if (line[0] == '>')
-				{
-					Strings::replace(line, "chr", "");
-					Strings::replace(line, "_u", "");
-					Strings::replace(line, " ", "");
-					Strings::replace(line, ">", "");
-					names.push_back(line);
-					offsets.push_back(offset);
-					cout << "  - extracting sequence: " << line << " at offset " << offset << endl;
-				}
-				else
+				packed.push_back(PackedSequence());
+				
+				if (!packed.back().load(in, line))
 				{
-					refseq << line;
-					offset += line.size();
+					packed.pop_back();
+					break;
 				}
+				Strings::replace(line, "chr", "");
+				Strings::replace(line, "_u", "");
+				Strings::replace(line, " ", "");
+				Strings::replace(line, ">", "");
+				names.push_back(line);
+				cout << "  - extracting sequence: " << line << " at offset " << offset << endl;
+				offset += packed.back().length;
 			}
 			in.close();
 			this->num_assemblies = names.size();
@@ -99,37 +155,68 @@ namespace ReadSlam
 			{
 				cout << endl << "Creating assemblies:" << endl;
 
-				string mega = refseq.str();
-				string assembly_sequence = "";
-			
-				for (int i=0, len=num_assemblies; i<len; ++i)
+				list<PackedSequence>::iterator it = packed.begin();
+				long memory = 0;
+				
+				for (int i=0; i<num_assemblies; ++i, ++it)
 				{
 					cout << "  - creating assembly: " << names[i] << endl;
-					
-					if (i == len - 1)
-					{
-						assembly_sequence = mega.substr(offsets[i], offset - offsets[i]);
-					}
-					else
-					{
-						assembly_sequence = mega.substr(offsets[i], offsets[i+1] - offsets[i]);
-					}
-					assemblies[i].init(names[i], assembly_sequence);
+					assemblies[i].init(names[i], *it);
+					assembly_ids.insert(make_pair(names[i], i));
+					memory += assemblies[i].reference.memory();
 				}
+				cout << "Reference memory: " << (memory / 1000000) << "MB" << endl;
 			}
 			this->length = offset;
 			cout << endl;
 			cout << "Total genome size: " << this->length << endl;
 		}
 		
-		//Index the genome
-		void build_index(int seed, bool bisulfite, bool usemap)
+		//Index the genome. A single strand index covers the reverse strands by searching with reverse complemented reads
+		void build_index(int seed, bool bisulfite, bool usemap, bool single = false)
 		{
 			int max = 0;
+			bool sparse = false;
+			
+			//The memory estimates depend on the strand mode
+			this->index_single = single;
+			this->bisulfite = bisulfite;
+			
+			//The genome-wide index has no pigeonhole search
+			if (index_global && pigeonhole > 0)
+			{
+				cerr << "Error: pigeonhole search cannot be used with the genome-wide index" << endl;
+				exit(1);
+			}
+			
+			//Compression and minimizer sampling are only done by the per-assembly vector index
+			if ((usemap || index_global) && (index_compressed || index_window > 0))
+			{
+				cerr << "Error: compressed and minimizer indexing cannot be used with the " << (usemap ? "<map>" : "genome-wide") << " index" << endl;
+				exit(1);
+			}
+			if (usemap && index_global)
+			{
+				cerr << "Error: the genome-wide index is a vector index, it cannot be used with the <map> index" << endl;
+				exit(1);
+			}
 			
-			if (usemap)
+			//Seeds too large for the dense tables are served by the sorted key index (unless the vector index was asked for
+			//by its layout options, in which case the seed is capped)
+			bool layout = index_global || index_compressed || index_window > 0;
+			
+			if (!usemap && !layout && seed > max_seed_raw() && memory_sparse(seed) < system.ram)
+			{
+				cout << "Seed " << seed << " is too large for the vector index, using the sparse index" << endl;
+				sparse = true;
+			}
+			if (usemap || sparse)
+			{
+				max = build_index_map(seed, bisulfite, sparse);
+			}
+			else if (index_global)
 			{
-				max = build_index_map(seed, bisulfite);
+				max = build_index_global(seed, bisulfite);
 			}
 			else
 			{
@@ -137,25 +224,80 @@ namespace ReadSlam
 			}
 			this->index_seed = max;
 			this->index_built = true;
-			this->index_usemap = usemap;
-			this->bisulfite = bisulfite;
+			this->index_usemap = usemap || sparse;
+			this->index_sparse = sparse;
+			this->index_global = index_global && !this->index_usemap;
+			this->index_compressed = index_compressed && !this->index_usemap && !this->index_global;
+			this->index_window = (this->index_usemap || this->index_global) ? 0 : index_window;
+			
+			build_repeats();
 		}
 		
-		//Build the raw index
-		int build_index_raw(int seed, bool bisulfite)
+		//Collect the high-frequency k-mers of every indexed strand into the repeat mask
+		void build_repeats()
+		{
+			repeats.clear();
+			
+			if (repeat_threshold <= 0) return;
+			
+			repeats.init(index_seed, index_single && bisulfite);
+			
+			if (index_global)
+			{
+				global.mask_repeats(repeats, repeat_threshold);
+			}
+			for (int i=0; i<num_assemblies && !index_global; ++i)
+			{
+				assemblies[i].forward.mask_repeats(repeats, repeat_threshold);
+				
+				if (!index_single)
+				{
+					assemblies[i].reverse.mask_repeats(repeats, repeat_threshold);
+				}
+			}
+			cout << "Repeat k-mers (over " << repeat_threshold << " copies): " << repeats.masked << endl;
+		}
+		
+		//Determine the maximum seed size the vector index can use in the available RAM
+		int max_seed_raw()
 		{
-			//Determine the maximum seed size
 			int max_seed = 0;
 			
-			for (int i=0; i<16; ++i)
+			//A single strand bisulfite index uses one bit per base (see DNA::seq2keys_ry)
+			bool ry = index_single && bisulfite;
+			int base = ry ? 2 : 4;
+			int limit = ry ? 31 : 16;
+			
+			for (int i=0; i<limit; ++i)
 			{
-				long max = (long)pow(4, i);
-				long size_idx_idx = (num_assemblies * 3 * max * sizeof(int)) / 1000000;
+				long max = (long)pow(base, i);
+				long tables = index_global ? 1 : num_assemblies;
+				long size_idx_idx = (tables * 3 * max * sizeof(int)) / 1000000;
 				long size_idx_seq = (2 * length * sizeof(int)) / 1000000;
-				long size_seq = (length * sizeof(char)) / 1000000;
+				long size_seq = (length / 4) / 1000000;
+				long size_build = 0;
+				
+				//A minimizer-sampled index keeps about 2 positions in every window + 1. The keys of a strand are freed once
+				//it is built, so only one strand's keys are counted
+				double sampled = (index_window > 1 && !index_global) ? 2.0 / (index_window + 1) : 1.0;
+				
+				if (sampled < 1)
+				{
+					size_idx_seq = (long)(sampled * length * sizeof(int)) / 1000000;
+					size_build = (longest() * sizeof(int)) / 1000000;
+				}
+				
+				//Compressed positions take at most the key bits and 2 more, and a key its count and a share of its block's
+				//start (see IndexCompressed). Each strand is built as a plain index before it is compressed
+				if (index_compressed && !index_global)
+				{
+					size_idx_idx = (tables * max * (sizeof(int) + sizeof(long long) / IndexCompressed::BLOCK)) / 1000000;
+					size_idx_seq = (long)(sampled * length * ((ry ? 1 : 2) * i + 2) / 8) / 1000000;
+					size_build = (2 * longest() * sizeof(int) + 3 * max * sizeof(int)) / 1000000;
+				}
 							
-				//2 strands * the combined size
-				long memreq = 2 * (size_idx_seq + size_idx_idx + size_seq);
+				//Indexed strands * the combined index size, plus the packed sequence (shared by both strands)
+				long memreq = strands() * (size_idx_seq + size_idx_idx) + size_build + size_seq;
 				
 				if (memreq >= system.ram) 
 				{
@@ -163,6 +305,81 @@ namespace ReadSlam
 				}
 				max_seed = i;
 			}
+			return max_seed;
+		}
+		
+		//Estimate the RAM (MB) needed by the hash index. Distinct keys are bounded by both the genome size and the key space
+		long memory_map(int seed)
+		{
+			double keys = min((double)length, pow(index_single && bisulfite ? 2.0 : 4.0, (double)seed));
+			long size_pos = (length * sizeof(int)) / 1000000;
+			long size_keys = (long)(keys * 2 * sizeof(IndexHash::Slot) / 1000000);
+			long size_seq = (length / 4) / 1000000;
+			
+			//Indexed strands * (positions + a table at most half full), plus the packed sequence
+			return strands() * (size_pos + size_keys) + size_seq;
+		}
+		
+		//Estimate the RAM (MB) needed by the sparse index (a key and an offset per distinct k-mer)
+		long memory_sparse(int seed)
+		{
+			double keys = min((double)length, pow(index_single && bisulfite ? 2.0 : 4.0, (double)seed));
+			long size_pos = (length * sizeof(int)) / 1000000;
+			long size_keys = (long)(keys * (sizeof(DNA::Kmer) + sizeof(int)) / 1000000);
+			long size_seq = (length / 4) / 1000000;
+			
+			//Indexed strands * (positions + keys), plus the packed sequence
+			return strands() * (size_pos + size_keys) + size_seq;
+		}
+		
+		//Number of strands that have their own index
+		int strands()
+		{
+			return index_single ? 1 : 2;
+		}
+		
+		//Positions in the vector indices
+		long index_positions()
+		{
+			long positions = 0;
+			
+			for (int i=0; i<num_assemblies; ++i)
+			{
+				positions += assemblies[i].forward.indexed + assemblies[i].reverse.indexed;
+			}
+			return positions;
+		}
+		
+		//Bytes used by the vector indices
+		long index_memory()
+		{
+			long memory = 0;
+			
+			for (int i=0; i<num_assemblies; ++i)
+			{
+				memory += assemblies[i].forward.memory_index() + assemblies[i].reverse.memory_index();
+			}
+			return memory;
+		}
+		
+		//Length of the longest assembly
+		long longest()
+		{
+			long longest = 0;
+			
+			for (int i=0; i<num_assemblies; ++i)
+			{
+				longest = std::max(longest, (long)assemblies[i].length);
+			}
+			return longest;
+		}
+		
+		//Build the raw index
+		int build_index_raw(int seed, bool bisulfite)
+		{
+			//Determine the maximum seed size
+			int max_seed = max_seed_raw();
+			
 			if (seed > max_seed)
 			{
 				seed = max_seed;
@@ -171,222 +388,1269 @@ namespace ReadSlam
 			cout << "Maximum seed: " << max_seed << endl;
 			cout << "Using seed: " << seed << endl;
 
+			cout << "Indexing threads: " << system.cpus << endl;
+
 			cout << endl << "Indexing:" << endl;
 			
 			for (int i=0; i<num_assemblies; ++i)
 			{
 				cout << "  - indexing assembly: " << assemblies[i].name << endl;
-				assemblies[i].build_index(seed, bisulfite, false);
+				assemblies[i].build_index(seed, bisulfite, false, false, index_single, system.cpus, index_compressed, index_window);
+			}
+			
+			if (index_window > 1)
+			{
+				cout << "Minimizer window: " << index_window << " (" << index_positions() << " positions indexed, "
+					<< (100.0 * index_positions() / (strands() * length)) << "% of the bases)" << endl;
+			}
+			
+			if (index_compressed)
+			{
+				long memory = 0;
+				long words = 0;
+				
+				for (int i=0; i<num_assemblies; ++i)
+				{
+					memory += assemblies[i].forward.index_compressed.memory() + assemblies[i].reverse.index_compressed.memory();
+					words += assemblies[i].forward.index_compressed.words.size() + assemblies[i].reverse.index_compressed.words.size();
+				}
+				cout << "Compressed positions: " << (memory / 1000000) << "MB (" << (words * 64.0 / (strands() * length)) << " bits a base)" << endl;
 			}
 			return seed;
 		}
 		
-		//Index the genome using a map
-		int build_index_map(int seed, bool bisulfite)
+		//Build one vector index over all of the assemblies
+		int build_index_global(int seed, bool bisulfite)
 		{
-			//Determine the maximum seed size
-			int max_seed = 0;
+			int max_seed = max_seed_raw();
 			
-			for (int i=0; i<16; ++i)
+			if (seed > max_seed)
 			{
-				long size_idx = (length * sizeof(int)) / 1000000;
-				long size_seq = (length * sizeof(char)) / 1000000;
-							
-				//2 strands * the combined size
-				long memreq = 2 * (size_idx + size_seq);
-				
-				if (memreq >= system.ram) 
-				{
-					break;
-				}
-				max_seed = i;
+				seed = max_seed;
 			}
 			cout << "System has " << system.ram << "MB RAM" << endl;
 			cout << "Maximum seed: " << max_seed << endl;
 			cout << "Using seed: " << seed << endl;
-
-			cout << endl << "Indexing:" << endl;
+			
+			cout << endl << "Indexing (genome-wide):" << endl;
+			
+			global.build(assemblies, seed, bisulfite, index_single);
 			
 			for (int i=0; i<num_assemblies; ++i)
 			{
-				cout << "  - indexing assembly: " << assemblies[i].name << endl;
-				assemblies[i].build_index(seed, bisulfite, true);
+				assemblies[i].forward.bisulfite = bisulfite;
+				assemblies[i].reverse.bisulfite = bisulfite;
 			}
+			cout << "Index memory: " << global.memory() / 1000000 << "MB" << endl;
 			return seed;
 		}
 		
-		//Map a single read to the genome
-		void map_read(Read& read)
+		//Index the genome using a hash (or a sorted array) of the distinct k-mers
+		int build_index_map(int seed, bool bisulfite, bool sparse = false)
 		{
-			if (!index_built)
+			if (seed < 1 || seed > DNA::MAX_KMER)
 			{
-				cerr << "The index must be built before mapping can be done" << endl;
+				cerr << "Seed must be between 1 and " << DNA::MAX_KMER << endl;
 				exit(1);
 			}
-			read.build_indices(index_seed, bisulfite);
+			long estimate = sparse ? memory_sparse(seed) : memory_map(seed);
 			
-			for (int i=0; i<num_assemblies; ++i)
+			cout << "System has " << system.ram << "MB RAM" << endl;
+			cout << "Estimated index size: " << estimate << "MB" << endl;
+			cout << "Using seed: " << seed << endl;
+			
+			if (estimate >= system.ram)
 			{
-				if (this->index_usemap)
-				{
-					read.search_map(assemblies[i].forward);
-					read.search_map(assemblies[i].reverse);
-				}
-				else
-				{
-					read.search(assemblies[i].forward);
-					read.search(assemblies[i].reverse);
-				}
+				cerr << "Warning: the " << (sparse ? "sparse" : "hash") << " index may not fit in RAM" << endl;
 			}
+
+			cout << endl << "Indexing:" << endl;
 			
-			if (++mapped_total % 1000 == 0)
+			long memory = 0;
+			
+			for (int i=0; i<num_assemblies; ++i)
 			{
-				cout << "  - " << mapped_total << "\r" << flush;
+				cout << "  - indexing assembly: " << assemblies[i].name << endl;
+				assemblies[i].build_index(seed, bisulfite, true, sparse, index_single);
+				memory += assemblies[i].forward.memory_keys() + assemblies[i].reverse.memory_keys();
 			}
-			switch (read.locations)
+			cout << "Index size: " << (memory / 1000000) << "MB" << endl;
+			return seed;
+		}
+		
+		//Lay out the on-disk/shared image of the index (for the seed and bisulfite mode set). Returns the total size in bytes
+		long long index_layout(IndexFile::Header& header, vector<IndexFile::Record>& records)
+		{
+			plain_layout();
+			
+			long long keys = 1LL << (2 * index_seed);
+
+			memset(&header, 0, sizeof(header));
+			memcpy(header.magic, IndexFile::MAGIC, sizeof(header.magic));
+			header.version = IndexFile::VERSION;
+			header.seed = index_seed;
+			header.bisulfite = bisulfite ? 1 : 0;
+			header.num_assemblies = num_assemblies;
+			header.length = length;
+			header.keys = keys;
+			
+			//Tables follow the header and the assembly table
+			records.resize(num_assemblies);
+			long long offset = sizeof(IndexFile::Header) + num_assemblies * sizeof(IndexFile::Record);
+			
+			for (int i=0; i<num_assemblies; ++i)
 			{
-				case 0 : ++mapped_failed; break;
-				case 1 : ++mapped_unique; break;
-				default: ++mapped_multi;
+				IndexFile::Record& r = records[i];
+				memset(&r, 0, sizeof(r));
+
+				if (assemblies[i].name.size() >= IndexFile::NAME_SIZE)
+				{
+					cerr << "Error: assembly name too long for index file: " << assemblies[i].name << endl;
+					exit(1);
+				}
+				strcpy(r.name, assemblies[i].name.c_str());
+				r.length = assemblies[i].length;
+				r.checksum = assemblies[i].reference.checksum();
+
+				IndexFile::Tables* t[2] = { &(r.forward), &(r.reverse) };
+				
+				for (int j=0; j<2; ++j)
+				{
+					t[j]->sorted  = offset = IndexFile::align(offset); offset += r.length * sizeof(int);
+					t[j]->counts  = offset = IndexFile::align(offset); offset += keys * sizeof(int);
+					t[j]->offsets = offset = IndexFile::align(offset); offset += keys * sizeof(int);
+				}
 			}
+			return offset;
 		}
 		
-		//Map a file of reads to the genome. Infile and outfile are ReadSlam format
-		void map_reads(string infile, string outfile, bool reset_counters)
+		//Save the index to disk so that later runs can map it instead of rebuilding it
+		void save_index(string outfile)
 		{
 			if (!index_built)
 			{
-				cerr << "The index must be built before mapping can be done" << endl;
+				cerr << "Error: the index must be built before it can be saved" << endl;
 				exit(1);
 			}
-			if (reset_counters)
+			IndexFile::Header header;
+			vector<IndexFile::Record> records;
+			long long size = index_layout(header, records);
+			long long keys = header.keys;
+			
+			cout << endl << "Saving index to file: " << outfile << endl;
+			
+			ofstream out (outfile.c_str(), ios::out | ios::binary);
+			
+			if (!out)
 			{
-				cout << "Mapping file:" << infile << endl;
-				mapped_total = 0;
-				mapped_unique = 0;
-				mapped_multi = 0;
-				mapped_failed = 0;
+				cerr << "Error: unable to open index file " << outfile << endl;
+				exit(1);
 			}
-			ifstream in (infile.c_str());
-			ofstream out (outfile.c_str());
+			out.write((const char*)&header, sizeof(header));
+			out.write((const char*)&(records[0]), num_assemblies * sizeof(IndexFile::Record));
 			
-			Read read;
+			//Write the tables in the order they were laid out
+			long long written = sizeof(IndexFile::Header) + num_assemblies * sizeof(IndexFile::Record);
 			
-			while (read.load(in))
+			for (int i=0; i<num_assemblies; ++i)
 			{
-				map_read(read);
-				read.save(out);
+				cout << "  - writing assembly: " << assemblies[i].name << endl;
+				
+				Sequence* s[2] = { &(assemblies[i].forward), &(assemblies[i].reverse) };
+				IndexFile::Tables* t[2] = { &(records[i].forward), &(records[i].reverse) };
+				
+				for (int j=0; j<2; ++j)
+				{
+					IndexFile::pad(out, written, t[j]->sorted);
+					out.write((const char*)s[j]->sorted, s[j]->length * sizeof(int));
+					written = t[j]->sorted + s[j]->length * sizeof(int);
+
+					IndexFile::pad(out, written, t[j]->counts);
+					out.write((const char*)s[j]->counts, keys * sizeof(int));
+					written = t[j]->counts + keys * sizeof(int);
+
+					IndexFile::pad(out, written, t[j]->offsets);
+					out.write((const char*)s[j]->offsets, keys * sizeof(int));
+					written = t[j]->offsets + keys * sizeof(int);
+				}
 			}
 			out.close();
-			in.close();
 			
-			if (reset_counters)
+			if (!out)
 			{
-				cout << "Total: "  << mapped_total << endl;
-				cout << "Failed: " << mapped_failed << endl;
-				cout << "Unique: " << mapped_unique << endl;
-				cout << "Multi: "  << mapped_multi << endl;
+				cerr << "Error: failed writing index file " << outfile << endl;
+				exit(1);
 			}
+			cout << "Index size: " << (size / 1000000) << "MB" << endl;
 		}
 		
-		//Multi threaded mapping
-		struct ThreadDataMap
+		//Map a previously saved index. The reference must already be loaded, it is checked against the index
+		void load_index(string infile)
 		{
-			ReadSlam::Genome* self;
-			string filename;
+			cout << endl << "Loading index from file: " << infile << endl;
 			
-			ThreadDataMap(ReadSlam::Genome* t, string f)
+			plain_layout();
+			
+			if (!index_file.open(infile))
 			{
-				self = t;
-				filename = f;
+				exit(1);
 			}
-		};		
-		static void* thread_exec_map(void* param)
-		{
-			ThreadDataMap* data = static_cast<ThreadDataMap*>(param);
-			ReadSlam::Genome* self = data->self;
-
-			string infile = data->filename;
-			string outfile = infile + ".mapping";
+			attach_index(index_file.data, index_file.size, infile);
 			
-			self->map_reads(infile, outfile, false);
-
-			remove(infile.c_str());
-			rename(outfile.c_str(), infile.c_str());
+			//Start paging in the key tables, they are hit on every lookup
+			const IndexFile::Record* records = (const IndexFile::Record*)(index_file.data + sizeof(IndexFile::Header));
+			long long keys = ((const IndexFile::Header*)index_file.data)->keys;
 			
-			delete data;
+			for (int i=0; i<num_assemblies; ++i)
+			{
+				index_file.prefetch(records[i].forward.counts, keys * sizeof(int));
+				index_file.prefetch(records[i].forward.offsets, keys * sizeof(int));
+				index_file.prefetch(records[i].reverse.counts, keys * sizeof(int));
+				index_file.prefetch(records[i].reverse.offsets, keys * sizeof(int));
+			}
 		}
-		//Map a file of reads using multiple threads
-		void map_threaded(string infile, string outfile)
+		
+		//Use an index held in a named shared memory segment. The first process to get here builds and
+		//publishes it, later processes (eg. other lanes on the same node) attach to it read-only
+		void share_index(string name, int seed, bool bisulfite)
 		{
-			if (!index_built)
+			if (num_assemblies == 0)
 			{
-				cerr << "The index must be built before mapping can be done" << endl;
+				cerr << "Error: the genome must be loaded before its index" << endl;
 				exit(1);
 			}
-			int numthreads = system.cpus - 1;
+			cout << endl << "Looking for shared index: " << SharedMemory::segment(name) << endl;
 			
-			cout << "System has " << system.cpus << " CPUs" << endl;
-			cout << "Maximum threads: " << numthreads << endl;
-
-			vector<string> readfiles;
-			vector<pthread_t> threads;
-
-			readfiles.resize(numthreads);
-			threads.resize(numthreads);
+			//Only a plain vector index of both strands can be shared. Every process caps the seed the same way
+			plain_layout();
 			
-			//Reset the counters
-			mapped_total = 0;
-			mapped_unique = 0;
-			mapped_multi = 0;
-			mapped_failed = 0;
-
-			//Split input file into multiple files (one per thread)
-			{
-				for (int i=0; i<numthreads; i++)
-				{
-					readfiles[i] = Strings::add_int(outfile + ".thread.", i);
-				}
-				cout << "Splitting input for " << numthreads << " threads..." << flush;
-				Files::interleave_split(infile, readfiles);
-				cout << "done" << endl;
-			}
-
-			//Launch threads to map reads
+			this->bisulfite = bisulfite;
+			this->index_seed = std::min(seed, max_seed_raw());
+			
+			if (index_shared.attach(name))
 			{
-				for (int n=0; n<numthreads; ++n)
-				{
-					pthread_create(&(threads[n]), NULL, thread_exec_map, new ThreadDataMap(this, readfiles[n]));
-				}
-				for (int n=0; n<numthreads; ++n)
-				{
-					pthread_join(threads[n], NULL);
-				}
+				attach_index(index_shared.data, index_shared.size, SharedMemory::segment(name), index_seed, bisulfite);
+				return;
 			}
-
-			//Merge results back into a final file
+			IndexFile::Header header;
+			vector<IndexFile::Record> records;
+			long long size = index_layout(header, records);
+			long long keys = header.keys;
+			
+			if (!index_shared.create(name, size))
 			{
-				cout << "Merging results into single file..." << flush;
-				Files::interleave_join(readfiles, outfile);
-				cout << "done" << endl;
+				//Another process published it while this one waited
+				index_shared.attach(name);
+				attach_index(index_shared.data, index_shared.size, SharedMemory::segment(name), index_seed, bisulfite);
+				return;
 			}
-
-			//Clean up
+			cout << "Building shared index (" << (size / 1000000) << "MB, seed " << index_seed << ")" << endl;
+			
+			char* data = index_shared.data;
+			memcpy(data, &header, sizeof(header));
+			memcpy(data + sizeof(header), &(records[0]), num_assemblies * sizeof(IndexFile::Record));
+			
+			//Each strand is copied into the segment as soon as it is built, and its private copy freed
+			for (int i=0; i<num_assemblies; ++i)
 			{
-				cout << "Cleaning up..." << flush;
-				for (int i=0; i<numthreads; i++)
+				cout << "  - indexing assembly: " << assemblies[i].name << endl;
+				
+				Sequence* s[2] = { &(assemblies[i].forward), &(assemblies[i].reverse) };
+				IndexFile::Tables* t[2] = { &(records[i].forward), &(records[i].reverse) };
+				
+				for (int j=0; j<2; ++j)
 				{
-					remove(readfiles[i].c_str());
+					s[j]->build_index(index_seed, bisulfite, false, system.cpus);
+					
+					memcpy(data + t[j]->sorted, s[j]->sorted, s[j]->length * sizeof(int));
+					memcpy(data + t[j]->counts, s[j]->counts, keys * sizeof(int));
+					memcpy(data + t[j]->offsets, s[j]->offsets, keys * sizeof(int));
+					
+					s[j]->release();
 				}
-				readfiles.clear();
-				cout << "done" << endl;
 			}
+			index_shared.publish();
+			cout << "Published shared index" << endl;
 			
-			//Report outcome
+			attach_index(index_shared.data, index_shared.size, SharedMemory::segment(name), index_seed, bisulfite);
+		}
+		
+		//Saved and shared indexes hold the full uncompressed per-assembly vector index of both strands only, so asking
+		//for another layout with them is an error rather than something quietly dropped
+		void plain_layout()
+		{
+			if (index_usemap || index_single || index_global || index_compressed || index_window > 1)
+			{
+				cerr << "Error: only a full uncompressed per-assembly vector index of both strands can be saved or shared" << endl;
+				exit(1);
+			}
+		}
+		
+		//Free the private index tables
+		void release_index()
+		{
+			for (int i=0; i<num_assemblies; ++i)
+			{
+				assemblies[i].forward.release();
+				assemblies[i].reverse.release();
+			}
+			global.clear();
+			index_built = false;
+		}
+		
+		//Validate an index image against the loaded reference and point the assemblies at its tables
+		//A seed (and bisulfite mode) asked for must match the index, otherwise they are taken from it
+		void attach_index(const char* data, long long size, string source, int seed = 0, bool bisulfite = false)
+		{
+			if (num_assemblies == 0)
+			{
+				cerr << "Error: the genome must be loaded before its index" << endl;
+				exit(1);
+			}
+			
+			//Validate the header
+			if (size < (long long)sizeof(IndexFile::Header))
+			{
+				cerr << "Error: index " << source << " is truncated" << endl;
+				exit(1);
+			}
+			const IndexFile::Header* header = (const IndexFile::Header*)data;
+			
+			if (memcmp(header->magic, IndexFile::MAGIC, sizeof(header->magic)) != 0 || header->version != IndexFile::VERSION)
+			{
+				cerr << "Error: " << source << " is not a ReadSlam index (or was built by a different version)" << endl;
+				exit(1);
+			}
+			if (header->num_assemblies != num_assemblies || header->length != length)
+			{
+				cerr << "Error: index was built from a different reference (assembly count or genome size differs)" << endl;
+				exit(1);
+			}
+			if (seed != 0 && (header->seed != seed || header->bisulfite != (bisulfite ? 1 : 0)))
+			{
+				cerr << "Error: index " << source << " has seed " << header->seed << (header->bisulfite ? " (bisulfite)" : "")
+					<< " but seed " << seed << (bisulfite ? " (bisulfite)" : "") << " was asked for" << endl;
+				exit(1);
+			}
+			if (size < (long long)sizeof(IndexFile::Header) + num_assemblies * (long long)sizeof(IndexFile::Record))
+			{
+				cerr << "Error: index " << source << " is truncated" << endl;
+				exit(1);
+			}
+			const IndexFile::Record* records = (const IndexFile::Record*)(data + sizeof(IndexFile::Header));
+			long long keys = header->keys;
+			
+			//Validate each assembly and attach its tables
+			for (int i=0; i<num_assemblies; ++i)
+			{
+				const IndexFile::Record& r = records[i];
+				Assembly& a = assemblies[i];
+				
+				cout << "  - checking assembly: " << a.name << endl;
+				
+				if (a.name != r.name || a.length != r.length || a.reference.checksum() != r.checksum)
+				{
+					cerr << "Error: assembly " << a.name << " does not match the reference the index was built from" << endl;
+					exit(1);
+				}
+				const IndexFile::Tables* t[2] = { &(r.forward), &(r.reverse) };
+				
+				for (int j=0; j<2; ++j)
+				{
+					long long bytes = sizeof(int);
+					
+					if (t[j]->sorted < 0 || t[j]->counts < 0 || t[j]->offsets < 0 || t[j]->sorted + r.length * bytes > size || t[j]->counts + keys * bytes > size || t[j]->offsets + keys * bytes > size)
+					{
+						cerr << "Error: index " << source << " is truncated" << endl;
+						exit(1);
+					}
+				}
+				a.forward.attach((const int*)(data + r.forward.sorted), (const int*)(data + r.forward.counts), (const int*)(data + r.forward.offsets), keys, header->bisulfite);
+				a.reverse.attach((const int*)(data + r.reverse.sorted), (const int*)(data + r.reverse.counts), (const int*)(data + r.reverse.offsets), keys, header->bisulfite);
+			}
+			this->index_seed = header->seed;
+			this->bisulfite = header->bisulfite;
+			this->index_usemap = false;
+			this->index_sparse = false;
+			this->index_single = false;
+			this->index_global = false;
+			this->index_compressed = false;
+			this->index_window = 0;
+			this->index_built = true;
+			
+			cout << "Seed: " << index_seed << endl;
+			cout << "Bisulfite: " << (this->bisulfite ? "yes" : "no") << endl;
+			
+			build_repeats();
+		}
+		
+		//Map a single read to the genome
+		void map_read(Read& read)
+		{
+			if (!index_built)
+			{
+				cerr << "The index must be built before mapping can be done" << endl;
+				exit(1);
+			}
+			if (map_cached(read))
+			{
+				count_read(read);
+				return;
+			}
+			if (exact_first && map_exact(read))
+			{
+				cache_read(read);
+				count_read(read);
+				return;
+			}
+			read.build_indices(index_seed, bisulfite, index_single, &repeats, index_window);
+			read.unique_only = unique_only;
+			
+			//The genome-wide index is searched once per strand
+			if (index_global)
+			{
+				search_global(read, global.forward, true, false);
+				search_global(read, index_single ? global.forward : global.reverse, false, index_single);
+			}
+			for (int i=0; i<num_assemblies && !read.settled() && !index_global; ++i)
+			{
+				if (this->pigeonhole > 0)
+				{
+					Sequence& f = assemblies[i].forward;
+					Sequence& r = assemblies[i].reverse;
+					
+					read.search_pigeonhole(f, f, index_usemap, false, pigeonhole);
+					read.search_pigeonhole(index_single ? f : r, r, index_usemap, index_single, pigeonhole);
+				}
+				else if (this->index_single)
+				{
+					if (this->index_usemap)
+					{
+						read.search_map(assemblies[i].forward);
+						read.search_map_reverse(assemblies[i].forward, assemblies[i].reverse);
+					}
+					else
+					{
+						read.search(assemblies[i].forward);
+						read.search_reverse(assemblies[i].forward, assemblies[i].reverse);
+					}
+				}
+				else if (this->index_usemap)
+				{
+					read.search_map(assemblies[i].forward);
+					read.search_map(assemblies[i].reverse);
+				}
+				else
+				{
+					read.search(assemblies[i].forward);
+					read.search(assemblies[i].reverse);
+				}
+			}
+			
+			cache_read(read);
+			count_read(read);
+		}
+		
+		//Look for exact matches using the read's non-overlapping seeds. Most reads have one, and for those this gives
+		//the same result as the full search without building and sorting every seed. Returns false if there are none
+		//A minimizer-sampled index does not have every tile, so it leaves all reads to the seed search
+		bool map_exact(Read& read)
+		{
+			if (index_window > 1) return false;
+			
+			read.build_tiles(index_seed, bisulfite, index_single);
+			read.unique_only = unique_only;
+			
+			int found = 0;
+			
+			if (index_global)
+			{
+				found += exact_global(read, global.forward, true, false);
+				found += exact_global(read, index_single ? global.forward : global.reverse, false, index_single);
+			}
+			for (int i=0; i<num_assemblies && !read.settled() && !index_global; ++i)
+			{
+				Sequence& f = assemblies[i].forward;
+				Sequence& r = assemblies[i].reverse;
+				
+				found += read.search_exact(f, f, index_usemap, false);
+				found += read.search_exact(index_single ? f : r, r, index_usemap, index_single);
+			}
+			if (found == 0) return false;
+			
+			__sync_add_and_fetch(&mapped_exact, 1);
+			return true;
+		}
+		
+		//The cache entry for a mapped read
+		MapCache::Entry cache_entry(Read& read)
+		{
+			MapCache::Entry entry;
+			entry.sequence = read.sequence;
+			entry.qualities = read.qualities;
+			entry.mismatches = read.mismatches;
+			entry.assembly = 0;
+			entry.forward = read.forward;
+			entry.pos = 0;
+			entry.locations = read.locations;
+			
+			if (read.locations > 0)
+			{
+				entry.assembly = assembly_ids.find(read.assembly)->second;
+				entry.pos = read.forward ? read.position : assemblies[entry.assembly].length - read.position - read.length;
+			}
+			return entry;
+		}
+		
+		//Give a read the result of an identical read. A read that did not map is left as it is
+		//No candidates are verified for it, so it adds none to the count
+		void reuse(const MapCache::Entry& entry, Read& read)
+		{
+			read.bisulfite = bisulfite;
+			read.aligned = 0;
+			
+			if (entry.locations == 0) return;
+			
+			Assembly& a = assemblies[entry.assembly];
+			read.place(entry.forward ? a.forward : a.reverse, entry.pos, entry.locations);
+		}
+		
+		//Reuse the result of an identical read if it is in the cache
+		bool map_cached(Read& read)
+		{
+			MapCache::Entry entry;
+			
+			if (!cache.find(read.sequence, entry) || !entry.reusable(read.qualities)) return false;
+			
+			reuse(entry, read);
+			__sync_add_and_fetch(&mapped_cached, 1);
+			return true;
+		}
+		
+		void cache_read(Read& read)
+		{
+			if (cache.enabled()) cache.store(cache_entry(read));
+		}
+		
+		//The strand and strand position of a hit in the genome-wide index. Mirrored hits are forward strand positions
+		//of the reverse complement seed, which start seed bases before the end of the seed on the reverse strand
+		inline Sequence& global_hit(unsigned long hit, bool forward, bool mirror, long& pos)
+		{
+			int a = global.locate(hit);
+			Sequence& s = forward ? assemblies[a].forward : assemblies[a].reverse;
+			
+			pos = hit - global.starts[a];
+			if (mirror) pos = s.length - pos - index_seed;
+			return s;
+		}
+		
+		//Search one strand of the genome-wide index. As with an index per assembly, each assembly is searched with
+		//the read's best seed that hits in that assembly: a seed's hits are in assembly order, so they are taken an
+		//assembly at a time, and the assemblies already searched by a better seed are skipped
+		void search_global(Read& read, const IndexGlobal::Table& table, bool forward, bool mirror)
+		{
+			SeedBuffers& b = read.scratch();
+			
+			if ((int)b.searched.size() < num_assemblies || ++b.search == 0)
+			{
+				b.searched.assign(num_assemblies, 0);
+				b.search = 1;
+			}
+			vector<int>& local = b.local;
+			int remaining = num_assemblies;
+			const unsigned int* hits;
+			
+			for (int i=0; i<read.length && remaining > 0 && !read.settled(); ++i)
+			{
+				const ReadIndex& r = read.index_at(i);
+				int key = mirror ? r.rval : r.val;
+				if (key == -1) continue;
+				
+				int count = global.lookup(table, key, hits);
+				
+				for (int p=0, end=0; p<count; p=end)
+				{
+					int a = global.locate(hits[p]);
+					end = global.assembly_end(hits + p, hits + count, a) - hits;
+					
+					if (b.searched[a] == b.search) continue;
+					
+					b.searched[a] = b.search;
+					remaining--;
+					
+					//Positions on the assembly's strand
+					local.resize(end - p);
+					
+					for (int h=p; h<end; ++h)
+					{
+						local[h - p] = hits[h] - global.starts[a];
+					}
+					read.align_hits(forward ? assemblies[a].forward : assemblies[a].reverse, &(local[0]), end - p, r.pos, mirror);
+				}
+			}
+		}
+		
+		//Exact matches on one strand of the genome-wide index, from the hits of the rarest tile (see Read::search_exact)
+		int exact_global(Read& read, const IndexGlobal::Table& table, bool forward, bool mirror)
+		{
+			const unsigned int* hits = NULL;
+			const unsigned int* rarest = NULL;
+			int fewest = 0;
+			int pos_read = 0;
+			
+			for (size_t t=0, len=read.tiles.size(); t<len; ++t)
+			{
+				const ReadIndex& r = read.tiles[t];
+				int key = mirror ? r.rval : r.val;
+				int count = key == -1 ? 0 : global.lookup(table, key, hits);
+				if (count == 0) return 0;
+				
+				if (rarest == NULL || count < fewest)
+				{
+					rarest = hits;
+					fewest = count;
+					pos_read = r.pos;
+				}
+			}
+			int found = 0;
+			
+			for (int p=0; p<fewest && !read.settled(); ++p)
+			{
+				long pos;
+				Sequence& s = global_hit(mirror ? rarest[fewest - 1 - p] : rarest[p], forward, mirror, pos);
+				long pos_genome = pos - pos_read;
+				
+				if (pos_genome < 0 || pos_genome + read.length > s.length || !read.exact(s, pos_genome))
+				{
+					continue;
+				}
+				read.align(s, pos_genome);
+				found++;
+			}
+			return found;
+		}
+		
+		//Update the mapping counters for a mapped read (they are shared by the mapping threads)
+		void count_read(Read& read)
+		{
+			if (__sync_add_and_fetch(&mapped_total, 1) % 1000 == 0)
+			{
+				cout << "  - " << mapped_total << "\r" << flush;
+			}
+			switch (read.locations)
+			{
+				case 0 : __sync_add_and_fetch(&mapped_failed, 1); break;
+				case 1 : __sync_add_and_fetch(&mapped_unique, 1); break;
+				default: __sync_add_and_fetch(&mapped_multi, 1);
+			}
+			__sync_add_and_fetch(&mapped_candidates, (long)read.aligned);
+		}
+		
+		//Report the mapping counters, with the verification rate over the time taken
+		void report_mapping(double seconds)
+		{
 			cout << "Total: "  << mapped_total << endl;
 			cout << "Failed: " << mapped_failed << endl;
 			cout << "Unique: " << mapped_unique << endl;
 			cout << "Multi: "  << mapped_multi << endl;
+			cout << "Candidates: " << mapped_candidates;
+			
+			if (seconds > 0)
+			{
+				cout << " (" << (long)(mapped_candidates / seconds) << " per second)";
+			}
+			cout << endl;
+			
+			if (cache.enabled() && mapped_total > 0)
+			{
+				cout << "Cached: " << mapped_cached << " (" << (100.0 * mapped_cached / mapped_total) << "% were duplicates)" << endl;
+			}
+			if (exact_first && index_window <= 1 && mapped_total > 0)
+			{
+				cout << "Exact: " << mapped_exact << " (" << (100.0 * mapped_exact / mapped_total) << "% skipped the seed search)" << endl;
+			}
+		}
+		
+		//Batched mapping: one strand of one assembly, with the index its seeds are looked up in
+		struct BatchTable
+		{
+			Sequence* index;
+			Sequence* strand;
+			bool mirror; //Reverse complement keys are looked up in the forward strand index (single strand mode)
+		};
+		
+		//A read's seed to look up in a table (seeds are tried in the read's order until one hits)
+		struct BatchSeed
+		{
+			int table;
+			int key;
+			int read;
+			int next; //The seed's place in the read's sorted indices
+		};
+		
+		//The index positions of the seed chosen for a read in a table
+		struct BatchHit
+		{
+			int table;
+			int key;
+			int count;
+			int read;
+			int pos_read;
+		};
+		
+		//A diagonal to verify
+		struct BatchCandidate
+		{
+			int pos;
+			int read;
+		};
+		
+		static bool compare_seed(const BatchSeed& a, const BatchSeed& b)
+		{
+			if (a.table != b.table) return a.table < b.table;
+			return a.key < b.key;
+		}
+		static bool compare_hit(const BatchHit& a, const BatchHit& b)
+		{
+			if (a.table != b.table) return a.table < b.table;
+			return a.key < b.key;
+		}
+		static bool compare_candidate(const BatchCandidate& a, const BatchCandidate& b)
+		{
+			if (a.pos != b.pos) return a.pos < b.pos;
+			return a.read < b.read;
+		}
+		
+		//The next seed of a read (from its nth index) that has a key in a table. Returns false if there are none left
+		bool next_seed(Read& read, const BatchTable& table, BatchSeed& seed, int n)
+		{
+			for (; n < read.length; ++n)
+			{
+				const ReadIndex& r = read.index_at(n);
+				int key = table.mirror ? r.rval : r.val;
+				
+				if (key != -1)
+				{
+					seed.key = key;
+					seed.next = n;
+					return true;
+				}
+			}
+			return false;
+		}
+		
+		//Point each read at the first read of the batch with the same sequence and qualities (if it is not the first itself)
+		//Copies with other qualities are left to the exact match pass and the cache, as their results can differ
+		void find_duplicates(Read* reads, int count, vector<int>& copy_of)
+		{
+			vector< pair<unsigned long long, int> > keys (count);
+			
+			for (int r=0; r<count; ++r)
+			{
+				keys[r] = make_pair(MapCache::hash(reads[r].qualities, MapCache::hash(reads[r].sequence)), r);
+			}
+			std::sort(keys.begin(), keys.end());
+			
+			for (int k=1, first=0; k<count; ++k)
+			{
+				if (keys[k].first != keys[first].first)
+				{
+					first = k;
+					continue;
+				}
+				int original = keys[first].second;
+				
+				if (reads[keys[k].second].sequence == reads[original].sequence && reads[keys[k].second].qualities == reads[original].qualities)
+				{
+					copy_of[keys[k].second] = original;
+				}
+			}
+		}
+		
+		//Map a batch of reads. The result is the same as map_read on each read, but the seeds of the whole batch are
+		//looked up in key order (so the count and offset tables are swept rather than hit at random), and each
+		//strand's candidates are verified in genome order (so the reference is read sequentially). A read's
+		//candidates are still verified in the same order as map_read, so ties resolve the same way.
+		//Only the vector index is batched, other modes map read by read
+		void map_batch(Read* reads, int count)
+		{
+			//The reads of a batch take turns with one set of seed buffers
+			SeedBuffers buffers;
+			
+			for (int r=0; r<count; ++r) reads[r].buffers = &buffers;
+			
+			if (pigeonhole > 0 || index_usemap || index_global)
+			{
+				for (int r=0; r<count; ++r)
+				{
+					map_read(reads[r]);
+					reads[r].buffers = NULL;
+				}
+				return;
+			}
+			
+			//Forward then reverse for each assembly, the order map_read searches them in
+			vector<BatchTable> tables;
+			
+			for (int i=0; i<num_assemblies; ++i)
+			{
+				BatchTable f = { &(assemblies[i].forward), &(assemblies[i].forward), false };
+				BatchTable r = { index_single ? &(assemblies[i].forward) : &(assemblies[i].reverse), &(assemblies[i].reverse), index_single };
+				tables.push_back(f);
+				tables.push_back(r);
+			}
+			
+			//Reads repeating an earlier read of the batch take its result at the end (-1 if not, -2 if found in the cache)
+			vector<int> copy_of (count, -1);
+			
+			if (cache.enabled())
+			{
+				find_duplicates(reads, count, copy_of);
+			}
+			
+			//The first seed of every read in every table
+			vector<BatchSeed> seeds;
+			vector<BatchHit> hits;
+			
+			for (int r=0; r<count; ++r)
+			{
+				if (copy_of[r] >= 0) continue;
+				
+				if (map_cached(reads[r]))
+				{
+					copy_of[r] = -2;
+					continue;
+				}
+				if (exact_first && map_exact(reads[r])) continue;
+				
+				reads[r].build_indices(index_seed, bisulfite, index_single, &repeats, index_window);
+				reads[r].unique_only = unique_only;
+				
+				for (int t=0, len=tables.size(); t<len; ++t)
+				{
+					BatchSeed seed = { t, 0, r, 0 };
+					if (next_seed(reads[r], tables[t], seed, 0)) seeds.push_back(seed);
+				}
+			}
+			
+			//Look the first seeds up in key order. A read whose seed has no positions moves straight on to its next seed
+			std::sort(seeds.begin(), seeds.end(), compare_seed);
+			
+			for (size_t j=0, len=seeds.size(); j<len; ++j)
+			{
+				if (j + 16 < len)
+				{
+					const BatchSeed& ahead = seeds[j + 16];
+					__builtin_prefetch(tables[ahead.table].index->counts + ahead.key);
+				}
+				BatchSeed& seed = seeds[j];
+				Sequence* index = tables[seed.table].index;
+				int positions = index->counts[seed.key];
+				
+				while (positions == 0 && next_seed(reads[seed.read], tables[seed.table], seed, seed.next + 1))
+				{
+					positions = index->counts[seed.key];
+				}
+				if (positions == 0) continue;
+				
+				BatchHit hit = { seed.table, seed.key, positions, seed.read, reads[seed.read].index_at(seed.next).pos };
+				hits.push_back(hit);
+			}
+			vector<BatchSeed>().swap(seeds);
+			
+			//Verify one table at a time, in genome order
+			std::sort(hits.begin(), hits.end(), compare_hit);
+			vector<BatchCandidate> candidates;
+			vector<int> decoded;
+			
+			for (size_t h=0, len=hits.size(); h<len; )
+			{
+				int t = hits[h].table;
+				const BatchTable& table = tables[t];
+				long length = table.strand->length;
+				candidates.clear();
+				
+				//The same diagonals align_hits would produce (hits are read from the index sequentially)
+				for (; h<len && hits[h].table == t; ++h)
+				{
+					const BatchHit& hit = hits[h];
+					const int* positions;
+					table.index->positions(hit.key, positions, decoded);
+					int seed = reads[hit.read].seed;
+					
+					for (int p=0; p<hit.count; ++p)
+					{
+						long pos = table.mirror ? length - positions[hit.count - 1 - p] - seed : positions[p];
+						long pos_genome = pos - hit.pos_read;
+						
+						if (pos_genome < 0 || pos_genome + reads[hit.read].length > length)
+						{
+							continue;
+						}
+						BatchCandidate c = { (int)pos_genome, hit.read };
+						candidates.push_back(c);
+					}
+				}
+				std::sort(candidates.begin(), candidates.end(), compare_candidate);
+				
+				//Candidates from different reads are interleaved, so the reference window of the one PREFETCH places
+				//ahead is requested while the current one is aligned and is in cache by the time it is reached
+				for (size_t c=0, n=candidates.size(); c<n; ++c)
+				{
+					if (c + Read::PREFETCH < n)
+					{
+						const BatchCandidate& ahead = candidates[c + Read::PREFETCH];
+						if (!reads[ahead.read].settled()) table.strand->prefetch(ahead.pos, reads[ahead.read].length);
+					}
+					Read& read = reads[candidates[c].read];
+					
+					if (!read.settled()) read.align(*(table.strand), candidates[c].pos);
+				}
+			}
+			
+			for (int r=0; r<count; ++r)
+			{
+				if (copy_of[r] >= 0)
+				{
+					reuse(cache_entry(reads[copy_of[r]]), reads[r]);
+					__sync_add_and_fetch(&mapped_cached, 1);
+				}
+				else if (copy_of[r] == -1)
+				{
+					cache_read(reads[r]);
+				}
+				count_read(reads[r]);
+				
+				//Only needed while mapping, so they do not sit in every queued read
+				vector<ReadIndex>().swap(reads[r].indices);
+				reads[r].buffers = NULL;
+			}
+		}
+		
+		//Map a file of reads to the genome. Infile and outfile are ReadSlam format
+		void map_reads(string infile, string outfile, bool reset_counters)
+		{
+			if (!index_built)
+			{
+				cerr << "The index must be built before mapping can be done" << endl;
+				exit(1);
+			}
+			if (reset_counters)
+			{
+				cout << "Mapping file:" << infile << endl;
+				mapped_total = 0;
+				mapped_unique = 0;
+				mapped_multi = 0;
+				mapped_failed = 0;
+				mapped_candidates = 0;
+				mapped_exact = 0;
+				mapped_cached = 0;
+			}
+			cache.init(cache_bits);
+			double started = system.seconds();
+			ifstream in (infile.c_str());
+			ofstream out (outfile.c_str());
+			
+			if (batch_size > 0)
+			{
+				vector<Read> reads (batch_size);
+				
+				while (true)
+				{
+					int count = 0;
+					
+					while (count < batch_size && reads[count].load(in)) count++;
+					if (count == 0) break;
+					
+					map_batch(&(reads[0]), count);
+					
+					for (int r=0; r<count; ++r)
+					{
+						reads[r].save(out);
+					}
+					if (count < batch_size) break;
+				}
+			}
+			else
+			{
+				Read read;
+				
+				while (read.load(in))
+				{
+					map_read(read);
+					read.save(out);
+				}
+			}
+			out.close();
+			in.close();
+			
+			if (reset_counters)
+			{
+				report_mapping(system.seconds() - started);
+			}
+		}
+		
+		//The counters of one mapping run, for compare_sampled
+		struct SampleStats
+		{
+			int seed;
+			long positions;
+			long memory;
+			long failed;
+			long unique;
+			long multi;
+			long candidates;
+			double seconds;
+		};
+		
+		SampleStats map_stats(string infile, string outfile)
+		{
+			double started = system.seconds();
+			map_reads(infile, outfile, true);
+			
+			SampleStats stats = { index_seed, index_positions(), index_memory(), mapped_failed, mapped_unique, mapped_multi, mapped_candidates, system.seconds() - started };
+			return stats;
+		}
+		
+		static void report_pair(string name, long full, long sampled)
+		{
+			cout << "  " << name << ": " << full << " / " << sampled;
+			
+			if (full > 0)
+			{
+				cout << " (" << (100.0 * sampled / full) << "%)";
+			}
+			cout << endl;
+		}
+		
+		//Map a file with the full vector index, then with the minimizers of each window positions only, and report how
+		//the two compare. The sampled mapping is written to the output. This is for choosing a window for nodes that do not
+		//have the RAM for the full index, so the node it runs on needs enough for both
+		void compare_sampled(string infile, string outfile, int seed, bool bisulfite, int window)
+		{
+			string fullfile = outfile + ".full";
+			
+			index_window = 0;
+			build_index(seed, bisulfite, false);
+			SampleStats full = map_stats(infile, fullfile);
+			
+			release_index();
+			
+			index_window = window;
+			build_index(seed, bisulfite, false);
+			SampleStats sampled = map_stats(infile, outfile);
+			
+			//Compare the best hit of each read (the reads are written in the same order)
+			long same = 0;
+			long tied = 0;
+			long better = 0;
+			long worse = 0;
+			long lost = 0;
+			long gained = 0;
+			{
+				ifstream a (fullfile.c_str());
+				ifstream b (outfile.c_str());
+				Read x;
+				Read y;
+				
+				while (x.load(a) && y.load(b))
+				{
+					if (x.locations == 0 && y.locations == 0) continue;
+					
+					if (y.locations == 0) lost++;
+					else if (x.locations == 0) gained++;
+					else if (y.score < x.score) better++;
+					else if (y.score > x.score) worse++;
+					else if (x.assembly == y.assembly && x.forward == y.forward && x.position == y.position) same++;
+					else tied++;
+				}
+			}
+			remove(fullfile.c_str());
+			
+			long mapped = full.unique + full.multi;
+			
+			cout << endl << "Full index / minimizers of " << window << ":" << endl;
+			report_pair("Seed", full.seed, sampled.seed);
+			report_pair("Positions", full.positions, sampled.positions);
+			report_pair("Index memory (MB)", full.memory / 1000000, sampled.memory / 1000000);
+			report_pair("Failed", full.failed, sampled.failed);
+			report_pair("Unique", full.unique, sampled.unique);
+			report_pair("Multi", full.multi, sampled.multi);
+			report_pair("Candidates", full.candidates, sampled.candidates);
+			report_pair("Milliseconds", (long)(full.seconds * 1000), (long)(sampled.seconds * 1000));
+			
+			//Of the reads the full index maps
+			if (mapped > 0)
+			{
+				cout << "  Same best hit: " << same << " (" << (100.0 * same / mapped) << "%)" << endl;
+				cout << "  Other hit, as good: " << tied << " (" << (100.0 * tied / mapped) << "%)" << endl;
+				cout << "  Other hit, better: " << better << " (" << (100.0 * better / mapped) << "%)" << endl;
+				cout << "  Other hit, worse: " << worse << " (" << (100.0 * worse / mapped) << "%)" << endl;
+				cout << "  Lost: " << lost << " (" << (100.0 * lost / mapped) << "%)" << endl;
+			}
+			cout << "  Gained: " << gained << endl;
+		}
+		
+		//Multi threaded mapping: a reader thread fills batches of reads, workers map them and the calling thread writes them out in order
+		struct ThreadDataMap
+		{
+			ReadSlam::Genome* self;
+			ReadQueue* queue;
+			ifstream* in;
+			
+			ThreadDataMap(ReadSlam::Genome* t, ReadQueue* q, ifstream* i)
+			{
+				self = t;
+				queue = q;
+				in = i;
+			}
+		};
+		static void* thread_exec_read(void* param)
+		{
+			ThreadDataMap* data = static_cast<ThreadDataMap*>(param);
+			ReadQueue* queue = data->queue;
+			
+			for (long number=0; ; ++number)
+			{
+				ReadBatch* batch = queue->take();
+				int size = 0;
+				int limit = batch->reads.size();
+				
+				for (; size<limit; ++size)
+				{
+					if (!batch->reads[size].load(*(data->in))) break;
+				}
+				batch->size = size;
+				
+				if (size == 0)
+				{
+					queue->recycle(batch);
+					break;
+				}
+				queue->push(batch, number);
+				
+				if (size < limit) break;
+			}
+			queue->finish();
+			return NULL;
+		}
+		static void* thread_exec_map(void* param)
+		{
+			ThreadDataMap* data = static_cast<ThreadDataMap*>(param);
+			int start = 0;
+			int end = 0;
+			SeedBuffers buffers;
+			
+			while (ReadBatch* batch = data->queue->claim(start, end))
+			{
+				if (data->self->batch_size > 0)
+				{
+					data->self->map_batch(&(batch->reads[start]), end - start);
+				}
+				else
+				{
+					for (int i=start; i<end; ++i)
+					{
+						batch->reads[i].buffers = &buffers;
+						data->self->map_read(batch->reads[i]);
+						batch->reads[i].buffers = NULL;
+					}
+				}
+				data->queue->complete(batch, end - start);
+			}
+			return NULL;
+		}
+		//Map a file of reads, through the threaded pipeline when the system has more than one CPU
+		void map_file(string infile, string outfile)
+		{
+			if (system.cpus > 1)
+			{
+				map_threaded(infile, outfile);
+			}
+			else
+			{
+				map_reads(infile, outfile, true);
+			}
+		}
+		
+		//Map a file of reads using multiple threads
+		void map_threaded(string infile, string outfile)
+		{
+			if (!index_built)
+			{
+				cerr << "The index must be built before mapping can be done" << endl;
+				exit(1);
+			}
+			int numthreads = system.cpus > 1 ? system.cpus - 1 : 1;
+			
+			cout << "System has " << system.cpus << " CPUs" << endl;
+			cout << "Mapping threads: " << numthreads << endl;
+
+			ifstream in (infile.c_str());
+			ofstream out (outfile.c_str());
+			
+			if (!in)
+			{
+				cerr << "Error: unable to open reads file " << infile << endl;
+				exit(1);
+			}
+			
+			//Reset the counters
+			mapped_total = 0;
+			mapped_unique = 0;
+			mapped_multi = 0;
+			mapped_failed = 0;
+			mapped_candidates = 0;
+			mapped_exact = 0;
+			mapped_cached = 0;
+			cache.init(cache_bits);
+			double started = system.seconds();
+			
+			//Enough batches in flight to keep every worker busy while one is read and one is written
+			//With batched mapping each worker claims a whole batch (there is one per worker in flight)
+			ReadQueue queue;
+			
+			if (batch_size > 0)
+			{
+				queue.init(numthreads + 2, batch_size, batch_size);
+			}
+			else
+			{
+				queue.init(2 * numthreads + 2, 10000, 64);
+			}
+			
+			ThreadDataMap data (this, &queue, &in);
+			pthread_t reader;
+			vector<pthread_t> threads (numthreads);
+			
+			pthread_create(&reader, NULL, thread_exec_read, &data);
+			
+			for (int n=0; n<numthreads; ++n)
+			{
+				pthread_create(&(threads[n]), NULL, thread_exec_map, &data);
+			}
+			
+			//Write batches as they complete, in input order
+			while (ReadBatch* batch = queue.next())
+			{
+				for (int i=0; i<batch->size; ++i)
+				{
+					batch->reads[i].save(out);
+				}
+				queue.recycle(batch);
+			}
+			
+			pthread_join(reader, NULL);
+			
+			for (int n=0; n<numthreads; ++n)
+			{
+				pthread_join(threads[n], NULL);
+			}
+			out.close();
+			in.close();
+			
+			//Report outcome
+			report_mapping(system.seconds() - started);
 		}		
 		
 		//Multi-threaded indexing
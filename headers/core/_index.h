@@ -1,13 +1,14 @@
 #pragma once
 
 #include "_dna.h"
+#include "_read.h"
 
 /**
  * Interface for a class that provides an index for a DNA sequence
  */
 namespace ReadSlam
 {
-	class Index
+	struct Index
 	{
 		 Index() { clear(); }
 		~Index() { clear(); }
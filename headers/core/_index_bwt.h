@@ -1,78 +1,281 @@
 #pragma once
 
+#include <queue>
 #include "_dna.h"
-#include "_index.h"
-#include <list>
 #include "_read.h"
+#include "_index.h"
+#include "_packed.h"
+#include "_sequence.h"
+#include "../algorithms/fm_index.h"
 
 /**
  * Implements the BWT to provide an index for a DNA sequence
+ *
+ * Each strand has an FM-index (in bisulfite mode over the C->T converted strand,
+ * so converted reads match exactly wherever the only differences are C->T).
+ * A read is searched backwards from its 3' end, allowing up to a fixed number
+ * of substitutions. Partial matches are expanded cheapest first, where the cost
+ * of a substitution is the quality of the base, so the high quality bases are
+ * the ones trusted first. The search stops once the cheapest partial match
+ * costs more than the best alignment found, and a lower bound on the
+ * substitutions still needed prunes branches that cannot finish.
+ *
+ * Candidates are verified against the packed reference with Read::align, so the
+ * scores match the seed-index mappers. Memory does not depend on any seed size.
  */
 namespace ReadSlam
 {
-	class IndexBWT : Index
+	struct IndexBWT : Index
 	{
+		//A partial match: read[0..i] still to match, the rows matching read[i+1..]
+		struct State
+		{
+			int i;
+			int diffs;
+			int penalty;
+			FMIndex::Range rows;
+		};
+
+		//Cheapest state first
+		struct ByPenalty
+		{
+			bool operator() (const State& a, const State& b) const
+			{
+				return a.penalty > b.penalty;
+			}
+		};
+
+		string name;
+		PackedSequence reference;
+		Sequence forward;
+		Sequence reverse;
+		FMIndex fm_forward;
+		FMIndex fm_reverse;
+		long length;
+		bool bisulfite;
+
+		int mismatches; //Most substitutions allowed
+		int max_hits;   //Most rows located for one match (larger ranges are repeats)
+
 		 IndexBWT() { clear(); }
 		~IndexBWT() { clear(); }
-		
-		//Load the index from disk
-		void load(string infile)
+
+		//Load the index from disk (the reference must be set with init first)
+		bool load(string infile)
 		{
-			//Load a BWT encoded genome
+			ifstream in (infile.c_str(), ios::binary);
+			int flag = 0;
+
+			in.read((char*)&flag, sizeof(int));
+			bisulfite = flag == 1;
+
+			if (!in.good() || !fm_forward.load(in) || !fm_reverse.load(in) || fm_forward.length != length || fm_reverse.length != length)
+			{
+				cerr << "Bad BWT index file (or it does not match " << name << "): " << infile << endl;
+				fm_forward.clear();
+				fm_reverse.clear();
+				return false;
+			}
+			forward.bisulfite = bisulfite;
+			reverse.bisulfite = bisulfite;
+			return true;
 		}
-	
+
 		//Save the index to disk
-		void save(string outfile)
+		bool save(string outfile)
 		{
-			//Write out the BWT encoded genome
+			ofstream out (outfile.c_str(), ios::binary);
+			int flag = bisulfite ? 1 : 0;
+
+			out.write((const char*)&flag, sizeof(int));
+			fm_forward.save(out);
+			fm_reverse.save(out);
+			out.close();
+
+			if (!out)
+			{
+				cerr << "Unable to write BWT index: " << outfile << endl;
+				return false;
+			}
+			return true;
 		}
-		
+
 		//Determine the maximum RAM that will be required given a sequence size (MegaBytes)
 		int memory(long size)
 		{
-			
+			//Two strands of BWT, checkpoints and samples, plus the packed reference
+			double per_base = 2 * (0.375 + 4.0 / fm_forward.sa_rate) + 0.25;
+			return (int)(size * per_base / 1000000);
 		}
-	
-		//Build the index given a DNA sequence
-		void build(string& sequence, int seed, bool bisulfite)
+
+		//Set the reference (needed for verification, whether the index is built or loaded)
+		void init(string name, string& sequence)
+		{
+			this->name = name;
+			this->length = sequence.size();
+			reference.assign(sequence);
+			forward.init(name, true, &reference);
+			reverse.init(name, false, &reference);
+		}
+
+		//Set the reference from an already packed sequence (which is taken, leaving it empty)
+		void init(string name, PackedSequence& packed)
 		{
-			
+			this->name = name;
+			this->length = packed.length;
+			reference.swap(packed);
+			forward.init(name, true, &reference);
+			reverse.init(name, false, &reference);
 		}
-		
+
+		//Build the index given a DNA sequence (the FM-index has no seed, the argument is only there for the Index interface)
+		void build(string& sequence, int /*seed*/, bool bisulfite)
+		{
+			init(name, sequence);
+			build(bisulfite);
+		}
+
+		//Build the index for the reference set with init (sorting with a number of threads)
+		void build(bool bisulfite, int threads = 1)
+		{
+			this->bisulfite = bisulfite;
+			forward.bisulfite = bisulfite;
+			reverse.bisulfite = bisulfite;
+
+			string strand;
+
+			reference.unpack(strand, true);
+			if (bisulfite) strand = DNA::bisulfite(strand);
+			fm_forward.build(strand, 64, threads);
+
+			reference.unpack(strand, false);
+			if (bisulfite) strand = DNA::bisulfite(strand);
+			fm_reverse.build(strand, 64, threads);
+		}
+
 		//Clear the index
 		void clear()
 		{
-			
+			name.clear();
+			reference.clear();
+			forward.clear();
+			reverse.clear();
+			fm_forward.clear();
+			fm_reverse.clear();
+			length = 0;
+			bisulfite = false;
+			mismatches = 2;
+			max_hits = 32;
 		}
-		
-		// //Count the number of keys in the index
-		// int count_keys()
-		// {
-		// 	
-		// }
-		// 	
-		// //Count how many values there are for a specific index key
-		// int count_vals(int key)
-		// {
-		// 	
-		// }
-		// 	
-		// //Get the list of the values in the index for a specified key
-		// void lookup(int key)
-		// {
-		// 	
-		// }
-	
-		//Map a read to the index
+
+		//Map a read to the index (both strands)
 		void search(Read& read)
 		{
-			
+			read.bisulfite = bisulfite;
+
+			string pattern = bisulfite ? DNA::bisulfite(read.sequence) : read.sequence;
+
+			search(read, pattern, fm_forward, forward);
+			search(read, pattern, fm_reverse, reverse);
 		}
-	
-		//Try aligning a read to the index at the specified position
+
+		//Try aligning a read to the index at the specified position (forward strand)
 		void align(Read& read, int pos)
 		{
-			
+			read.align(forward, pos);
+		}
+
+		//Backtracking search of one strand
+		private: void search(Read& read, const string& pattern, FMIndex& fm, Sequence& strand)
+		{
+			int m = pattern.size();
+			if (m == 0 || m > length) return;
+
+			vector<int> bound;
+			lower_bounds(fm, pattern, bound);
+
+			priority_queue<State, vector<State>, ByPenalty> states;
+
+			State start = { m - 1, 0, 0, fm.all() };
+			states.push(start);
+
+			while (!states.empty())
+			{
+				State s = states.top();
+				states.pop();
+
+				//Nothing left can match as well as the best alignment so far (or the read is already known not to be unique)
+				if (s.penalty > read.score || read.settled()) break;
+
+				if (s.i < 0)
+				{
+					report(read, fm, strand, s.rows);
+					continue;
+				}
+				if (s.diffs + bound[s.i] > mismatches) continue;
+
+				int c = FMIndex::code(pattern[s.i]);
+
+				for (int b=0; b<4; ++b)
+				{
+					//Converted strands have no C
+					if (bisulfite && b == 1) continue;
+
+					State next = { s.i - 1, s.diffs, s.penalty, fm.extend(s.rows, b) };
+
+					if (next.rows.empty()) continue;
+
+					if (b != c)
+					{
+						if (s.diffs == mismatches) continue;
+
+						next.diffs++;
+						next.penalty += read.qualities[s.i];
+					}
+					states.push(next);
+				}
+			}
+		}
+
+		//Verify the located rows of a complete match
+		private: void report(Read& read, FMIndex& fm, Sequence& strand, FMIndex::Range rows)
+		{
+			for (long row = rows.lo, end = min(rows.hi, rows.lo + max_hits); row < end && !read.settled(); ++row)
+			{
+				long pos = fm.locate(row);
+
+				if (pos + read.length > length) continue;
+
+				read.align(strand, pos);
+			}
+		}
+
+		//Lower bound on the substitutions needed in read[0..i], for each i
+		//Read segments that do not occur in the strand each need one; they are found greedily from the 3' end
+		private: void lower_bounds(FMIndex& fm, const string& pattern, vector<int>& bound)
+		{
+			int m = pattern.size();
+			bound.assign(m, 0);
+
+			FMIndex::Range r = fm.all();
+
+			for (int k=m-1, end=m-1; k>=0; --k)
+			{
+				int c = FMIndex::code(pattern[k]);
+
+				if (c != -1) r = fm.extend(r, c);
+
+				if (c == -1 || r.empty())
+				{
+					bound[end]++;
+					r = fm.all();
+					end = k - 1;
+				}
+			}
+			for (int i=1; i<m; ++i)
+			{
+				bound[i] += bound[i-1];
+			}
 		}
 	};
 }
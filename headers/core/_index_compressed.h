@@ -0,0 +1,199 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+/**
+ * Elias-Fano coded positions for the vector index. The positions of each key
+ * are ascending, so each list is stored as the low bits of every position, as
+ * they are, followed by the high bits in unary (a set bit per position after
+ * as many clear bits as the high part has grown). A list of n positions on a
+ * strand of length L takes about log2(L/n) low bits and under 2 high bits a
+ * position, against 32 for a plain int: about 2 * seed + 2 bits when the lists
+ * are as long as the genome makes them on average, and log2(L) + 2 when they
+ * are shorter.
+ *
+ * The lists are packed end to end in key order. The size of a list follows
+ * from its count, so only the start of every BLOCK keys is kept and a list is
+ * found by adding up the sizes of the lists before it in its block (a block of
+ * counts is one cache line, which the lookup has fetched anyway). This takes
+ * the place of the offsets table.
+ */
+namespace ReadSlam
+{
+	struct IndexCompressed
+	{
+		static const int BLOCK = 16;
+
+		vector<unsigned long long> words;
+		vector<unsigned long long> blocks; //First bit of every BLOCK keys' lists
+		long universe;                     //Positions are below this (the strand length)
+		int  top;                          //floor(log2(universe))
+
+		 IndexCompressed() { clear(); }
+		~IndexCompressed() { clear(); }
+
+		void clear()
+		{
+			vector<unsigned long long>().swap(words);
+			vector<unsigned long long>().swap(blocks);
+			universe = 0;
+			top = 0;
+		}
+
+		bool empty()
+		{
+			return blocks.empty();
+		}
+
+		//Bytes of memory used
+		long memory()
+		{
+			return (words.capacity() + blocks.capacity()) * sizeof(unsigned long long);
+		}
+
+		//Low bits kept for each position of a list of count positions (log2(universe / count), rounded either way)
+		inline int low_bits(int count) const
+		{
+			if (count == 0) return 0;
+			return std::max(0, top - (31 - __builtin_clz(count)));
+		}
+
+		//Bits taken by a list of count positions
+		inline long size(int count) const
+		{
+			if (count == 0) return 0;
+
+			int low = low_bits(count);
+			return (long)count * (low + 1) + ((universe - 1) >> low);
+		}
+
+		//Code the positions of a vector index (grouped by key, each group ascending, in key order)
+		void build(const int* sorted, const int* counts, long keys, long universe)
+		{
+			clear();
+
+			this->universe = universe;
+			this->top = universe > 1 ? 63 - __builtin_clzll(universe) : 0;
+
+			blocks.resize((keys + BLOCK - 1) / BLOCK);
+
+			unsigned long long total = 0;
+
+			for (long k=0; k<keys; ++k)
+			{
+				if (k % BLOCK == 0) blocks[k / BLOCK] = total;
+				total += size(counts[k]);
+			}
+			words.assign((total + 63) / 64, 0);
+
+			for (long k=0, bit=0; k<keys; ++k)
+			{
+				if (counts[k] == 0) continue;
+
+				encode(bit, sorted, counts[k]);
+				bit += size(counts[k]);
+				sorted += counts[k];
+			}
+		}
+
+		//Decode the positions of a key into out, in ascending order (counts is the table the index was built from)
+		inline void decode(const int* counts, int key, int* out) const
+		{
+			int count = counts[key];
+			int low = low_bits(count);
+			long bit = start(counts, key);
+			long high = bit + (long)count * low;
+			long word = high / 64;
+			unsigned long long bits = words[word] & (~0ULL << (high % 64));
+
+			for (int i=0; i<count; ++i)
+			{
+				while (bits == 0) bits = words[++word];
+
+				long b = word * 64 + __builtin_ctzll(bits);
+				bits &= bits - 1;
+
+				out[i] = (int)(((b - high - i) << low) | get(bit + (long)i * low, low));
+			}
+		}
+
+		//The position of a given rank (0 is the lowest) among the positions of a key
+		inline int at(const int* counts, int key, int rank) const
+		{
+			int count = counts[key];
+			int low = low_bits(count);
+			long bit = start(counts, key);
+			long high = bit + (long)count * low;
+			long word = high / 64;
+			unsigned long long bits = words[word] & (~0ULL << (high % 64));
+
+			//Skip whole words of the high part, then the set bits before the rank in the word that has it
+			int left = rank;
+
+			for (int c; (c = __builtin_popcountll(bits)) <= left; )
+			{
+				left -= c;
+				bits = words[++word];
+			}
+			for (; left > 0; --left)
+			{
+				bits &= bits - 1;
+			}
+			long b = word * 64 + __builtin_ctzll(bits);
+
+			return (int)(((b - high - rank) << low) | get(bit + (long)rank * low, low));
+		}
+
+		//First bit of a key's list
+		private: inline long start(const int* counts, int key) const
+		{
+			long bit = blocks[key / BLOCK];
+
+			for (int k=key - key % BLOCK; k<key; ++k)
+			{
+				bit += size(counts[k]);
+			}
+			return bit;
+		}
+
+		private: void encode(long bit, const int* positions, int count)
+		{
+			int low = low_bits(count);
+			long high = bit + (long)count * low;
+
+			for (int i=0; i<count; ++i)
+			{
+				put(bit + (long)i * low, positions[i] & ((1ULL << low) - 1), low);
+
+				long b = high + ((long)positions[i] >> low) + i;
+				words[b / 64] |= 1ULL << (b % 64);
+			}
+		}
+
+		//Write the bits of a value (which fits them) starting at a bit
+		private: inline void put(long bit, unsigned long long value, int bits)
+		{
+			if (bits == 0) return;
+
+			int shift = bit % 64;
+			words[bit / 64] |= value << shift;
+
+			if (shift + bits > 64) words[bit / 64 + 1] |= value >> (64 - shift);
+		}
+
+		//Read a number of bits starting at a bit
+		private: inline unsigned long long get(long bit, int bits) const
+		{
+			if (bits == 0) return 0;
+
+			int shift = bit % 64;
+			unsigned long long value = words[bit / 64] >> shift;
+
+			if (shift + bits > 64) value |= words[bit / 64 + 1] << (64 - shift);
+			return value & ((1ULL << bits) - 1);
+		}
+	};
+}
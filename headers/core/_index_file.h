@@ -0,0 +1,69 @@
+#pragma once
+
+#include <string>
+#include <cstring>
+#include <fstream>
+
+using namespace std;
+
+/**
+ * On-disk layout of a genome index (see Genome::save_index and Genome::load_index)
+ *
+ * [IndexHeader][IndexRecord x num_assemblies][tables...]
+ *
+ * Each assembly has a forward and a reverse table set (sorted, counts, offsets)
+ * stored as raw int arrays. Every table starts on an 8 byte boundary so that the
+ * file can be mapped and used in place.
+ */
+namespace ReadSlam
+{
+	namespace IndexFile
+	{
+		static const char MAGIC[8] = {'R','S','L','A','M','I','D','X'};
+		static const int VERSION = 2;
+		static const int NAME_SIZE = 128;
+
+		struct Header
+		{
+			char magic[8];
+			int  version;
+			int  seed;
+			int  bisulfite;
+			int  num_assemblies;
+			long long length; //Total genome length
+			long long keys;   //Number of entries in each counts/offsets table (4^seed)
+		};
+
+		//A table set for one strand of one assembly (byte offsets into the file)
+		struct Tables
+		{
+			long long sorted;
+			long long counts;
+			long long offsets;
+		};
+
+		struct Record
+		{
+			char name[NAME_SIZE];
+			long long length;
+			unsigned long long checksum; //Of the packed reference (PackedSequence::checksum), used to validate against the reference
+			Tables forward;
+			Tables reverse;
+		};
+
+		//Round a byte offset up to the next 8 byte boundary
+		static long long align(long long offset)
+		{
+			return (offset + 7) & ~7LL;
+		}
+
+		//Write a block of zeros (padding to the next table)
+		static void pad(ofstream& out, long long from, long long to)
+		{
+			for (long long i=from; i<to; ++i)
+			{
+				out.put(0);
+			}
+		}
+	}
+}
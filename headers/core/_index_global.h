@@ -0,0 +1,215 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include "_dna.h"
+#include "_assembly.h"
+#include "_repeat_mask.h"
+
+using namespace std;
+
+/**
+ * One vector index over the whole genome. The strands of every assembly are
+ * laid end to end (in assembly order) and indexed as a single sequence, so the
+ * key tables are allocated once however many contigs the reference has, and a
+ * read looks each seed up once per strand rather than once per assembly. The
+ * hits of a seed are still visited a run per assembly they fall in (a binary
+ * search each), so a seed costs at most one step per assembly, never one per hit.
+ *
+ * Keys are built per assembly, so no seed spans two of them. A hit is a
+ * position in the concatenated coordinates and is translated back to its
+ * assembly by a binary search of the assembly starts. Positions are unsigned,
+ * which allows genomes of up to 4 Gbp.
+ */
+namespace ReadSlam
+{
+	struct IndexGlobal
+	{
+		struct Table
+		{
+			vector<unsigned int> sorted;  //Concatenated positions, grouped by key
+			vector<unsigned int> offsets; //Start of each key's positions
+			vector<int> counts;
+		};
+
+		Table forward;
+		Table reverse;                //Reverse strands, each in its own reverse strand coordinates
+		vector<unsigned long> starts; //Start of each assembly in the concatenated coordinates, then the total
+		int  seed;
+		bool bisulfite;
+		bool single;                  //Only the forward strands are indexed (see Sequence::ry)
+
+		 IndexGlobal() { clear(); }
+		~IndexGlobal() { clear(); }
+
+		void clear()
+		{
+			clear(forward);
+			clear(reverse);
+			vector<unsigned long>().swap(starts);
+			seed = 0;
+			bisulfite = false;
+			single = false;
+		}
+
+		bool empty()
+		{
+			return starts.empty();
+		}
+
+		//Bytes of memory used
+		long memory()
+		{
+			return memory(forward) + memory(reverse) + starts.capacity() * sizeof(unsigned long);
+		}
+
+		void build(vector<Assembly>& assemblies, int seed, bool bisulfite, bool single)
+		{
+			clear();
+
+			this->seed = seed;
+			this->bisulfite = bisulfite;
+			this->single = single;
+
+			unsigned long total = 0;
+
+			for (size_t i=0, len=assemblies.size(); i<len; ++i)
+			{
+				starts.push_back(total);
+				total += assemblies[i].length;
+			}
+			starts.push_back(total);
+
+			if (total > 0xFFFFFFFFUL)
+			{
+				cerr << "Error: the genome is too large for a genome-wide index (" << total << " bases)" << endl;
+				exit(1);
+			}
+			build(forward, assemblies, true);
+
+			if (!single)
+			{
+				build(reverse, assemblies, false);
+			}
+		}
+
+		//The assembly a concatenated position falls in
+		inline int locate(unsigned long pos) const
+		{
+			return upper_bound(starts.begin(), starts.end(), pos) - starts.begin() - 1;
+		}
+
+		//The positions of a key (NULL if it has none, which may be every key when the index is empty)
+		inline int lookup(const Table& table, int key, const unsigned int*& hits) const
+		{
+			int count = table.counts[key];
+			hits = count > 0 ? &(table.sorted[table.offsets[key]]) : NULL;
+			return count;
+		}
+
+		//The end of the run of ascending hits [first, last) that fall in the same assembly as the first
+		inline const unsigned int* assembly_end(const unsigned int* first, const unsigned int* last, int assembly) const
+		{
+			return lower_bound(first + 1, last, starts[assembly + 1]);
+		}
+
+		//Add the keys with more than threshold positions on an indexed strand to the mask
+		long mask_repeats(RepeatMask& mask, int threshold)
+		{
+			long added = 0;
+
+			for (int t=0; t<(single ? 1 : 2); ++t)
+			{
+				const vector<int>& counts = t == 0 ? forward.counts : reverse.counts;
+
+				for (size_t k=0, len=counts.size(); k<len; ++k)
+				{
+					if (counts[k] > threshold)
+					{
+						mask.add(k);
+						added++;
+					}
+				}
+			}
+			return added;
+		}
+
+		private: void clear(Table& table)
+		{
+			vector<unsigned int>().swap(table.sorted);
+			vector<unsigned int>().swap(table.offsets);
+			vector<int>().swap(table.counts);
+		}
+
+		private: long memory(Table& table)
+		{
+			return (table.sorted.capacity() + table.offsets.capacity()) * sizeof(unsigned int) + table.counts.capacity() * sizeof(int);
+		}
+
+		//The keys of one strand of an assembly (-1 where there is none)
+		private: void keys(Assembly& assembly, bool strand, vector<int>& keys)
+		{
+			string sequence;
+			assembly.reference.unpack(sequence, strand);
+
+			//A single strand bisulfite index uses the purine/pyrimidine alphabet
+			if (single && bisulfite)
+			{
+				vector<DNA::Kmer> ry;
+				DNA::seq2keys_ry(sequence, ry, seed);
+				keys.resize(ry.size());
+
+				for (size_t i=0, len=ry.size(); i<len; ++i)
+				{
+					keys[i] = ry[i] == DNA::NO_KMER ? -1 : (int)ry[i];
+				}
+				return;
+			}
+			DNA::seq2indices(sequence, keys, seed, bisulfite);
+		}
+
+		//Counting sort of every assembly's positions on a strand by key. The keys of each assembly are built
+		//twice (once to count, once to place) rather than kept, so only one assembly's keys are held at a time
+		private: void build(Table& table, vector<Assembly>& assemblies, bool strand)
+		{
+			long max = 1L << ((single && bisulfite ? 1 : 2) * seed);
+			vector<int> k;
+
+			table.counts.assign(max, 0);
+			table.offsets.assign(max, 0);
+
+			for (size_t i=0, len=assemblies.size(); i<len; ++i)
+			{
+				keys(assemblies[i], strand, k);
+
+				for (size_t j=0, n=k.size(); j<n; ++j)
+				{
+					if (k[j] != -1) table.counts[k[j]]++;
+				}
+			}
+
+			unsigned long offset = 0;
+
+			for (long key=0; key<max; ++key)
+			{
+				table.offsets[key] = offset;
+				offset += table.counts[key];
+			}
+			table.sorted.resize(offset);
+
+			//Assemblies are placed in order and their positions ascending, so each key's positions are ascending
+			vector<unsigned int> cursors (table.offsets);
+
+			for (size_t i=0, len=assemblies.size(); i<len; ++i)
+			{
+				cout << "  - indexing assembly: " << assemblies[i].name << (strand ? " (+)" : " (-)") << endl;
+				keys(assemblies[i], strand, k);
+
+				for (size_t j=0, n=k.size(); j<n; ++j)
+				{
+					if (k[j] != -1) table.sorted[cursors[k[j]]++] = starts[i] + j;
+				}
+			}
+		}
+	};
+}
@@ -0,0 +1,186 @@
+#pragma once
+
+#include <vector>
+#include <iostream>
+#include "_dna.h"
+
+using namespace std;
+
+/**
+ * Compact seed index: an open addressing (linear probing) hash from a k-mer key
+ * to the run of its positions in one contiguous position array.
+ *
+ * Memory is 16 bytes per distinct k-mer (at most half full) plus 4 bytes per
+ * indexed position, against 40+ bytes per position for map<int, list<int> >.
+ * Lookups are O(1) and the candidate positions for a key are contiguous and in
+ * ascending order.
+ */
+namespace ReadSlam
+{
+	struct IndexHash
+	{
+		typedef DNA::Kmer Kmer;
+		static const Kmer EMPTY = DNA::NO_KMER;
+
+		struct Slot
+		{
+			Kmer key;
+			int offset;
+			int count;
+		};
+
+		vector<Slot> slots;
+		vector<int>  positions;
+		unsigned long long mask;
+		int  bits;
+		long used;
+
+		 IndexHash() { clear(); }
+		~IndexHash() { clear(); }
+
+		void clear()
+		{
+			vector<Slot>().swap(slots);
+			vector<int>().swap(positions);
+			mask = 0;
+			bits = 0;
+			used = 0;
+		}
+
+		//Bytes of memory used
+		long memory()
+		{
+			return slots.capacity() * sizeof(Slot) + positions.capacity() * sizeof(int);
+		}
+
+		//Number of distinct keys
+		long size()
+		{
+			return used;
+		}
+
+		//Build from a vector of keys, one per position (-1 or NO_KMER entries are not indexed)
+		template <class K>
+		void build(const vector<K>& keys)
+		{
+			clear();
+			resize(10);
+
+			//Count the positions for each key
+			long total = 0;
+
+			for (size_t i=0, len=keys.size(); i<len; ++i)
+			{
+				if (keys[i] == (K)-1) continue;
+
+				insert(keys[i])->count++;
+				total++;
+			}
+
+			//Give each key its run of the position array. The count becomes a fill cursor
+			long offset = 0;
+
+			for (size_t i=0, len=slots.size(); i<len; ++i)
+			{
+				if (slots[i].key == EMPTY) continue;
+
+				slots[i].offset = offset;
+				offset += slots[i].count;
+				slots[i].count = 0;
+			}
+
+			//Scatter the positions (ascending within each key)
+			positions.resize(total);
+
+			for (size_t i=0, len=keys.size(); i<len; ++i)
+			{
+				if (keys[i] == (K)-1) continue;
+
+				Slot* s = find(keys[i]);
+				positions[s->offset + s->count] = i;
+				s->count++;
+			}
+		}
+
+		//Find the positions for a key. Returns the number of positions (0 if the key is absent)
+		int lookup(Kmer key, const int*& hits)
+		{
+			if (key == EMPTY || used == 0) return 0;
+
+			Slot* s = find(key);
+			if (s == NULL) return 0;
+
+			hits = &(positions[s->offset]);
+			return s->count;
+		}
+
+		//Number of positions for a key
+		int count(Kmer key)
+		{
+			const int* hits;
+			return lookup(key, hits);
+		}
+
+		private: inline unsigned long long hash(Kmer key)
+		{
+			return (key * 0x9E3779B97F4A7C15ULL) >> (64 - bits);
+		}
+
+		private: Slot* find(Kmer key)
+		{
+			for (unsigned long long i = hash(key); ; i = (i + 1) & mask)
+			{
+				if (slots[i].key == key) return &(slots[i]);
+				if (slots[i].key == EMPTY) return NULL;
+			}
+		}
+
+		//Find or add a key, growing the table to stay at most half full
+		private: Slot* insert(Kmer key)
+		{
+			if ((used + 1) * 2 > (long)slots.size())
+			{
+				resize(bits + 1);
+			}
+			for (unsigned long long i = hash(key); ; i = (i + 1) & mask)
+			{
+				if (slots[i].key == key) return &(slots[i]);
+
+				if (slots[i].key == EMPTY)
+				{
+					slots[i].key = key;
+					slots[i].offset = 0;
+					slots[i].count = 0;
+					used++;
+					return &(slots[i]);
+				}
+			}
+		}
+
+		//Rehash into a table of 2^bits slots
+		private: void resize(int bits)
+		{
+			vector<Slot> old;
+			old.swap(slots);
+
+			Slot blank = { EMPTY, 0, 0 };
+			slots.resize(1ULL << bits, blank);
+			this->bits = bits;
+			this->mask = (1ULL << bits) - 1;
+
+			for (size_t i=0, len=old.size(); i<len; ++i)
+			{
+				if (old[i].key == EMPTY) continue;
+
+				for (unsigned long long j = hash(old[i].key); ; j = (j + 1) & mask)
+				{
+					if (slots[j].key == EMPTY)
+					{
+						slots[j] = old[i];
+						break;
+					}
+				}
+			}
+		}
+	};
+}
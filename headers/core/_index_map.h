@@ -2,17 +2,19 @@
 
 #include "_dna.h"
 #include "_index.h"
+#include "_index_hash.h"
 
 /**
  * Represents an index for a DNA sequence
+ * IndexMap hashes each distinct key to a run of one contiguous position array
  */
 namespace ReadSlam
 {
 	struct IndexMap : Index
 	{
-		//The index is a map of lists
-		map<int, list<int>* > index;
-		map<int, list<int>* >::iterator iterator;		
+		//The index is a hash of keys into a position array
+		IndexHash index;
+		int length;
 		
 		bool bisulfite;
 		int seed;
@@ -38,6 +40,7 @@ namespace ReadSlam
 			index.clear();
 			bisulfite = false;
 			seed = 0;
+			length = 0;
 		}
 		
 		//Count the number of keys in the index
@@ -47,93 +50,66 @@ namespace ReadSlam
 		}
 
 		//Count how many entries there are for a specific index key
-		int count(int key)
+		int count(DNA::Kmer key)
 		{
-			if (key < 0) return 0;
-			iterator.find(key);
-			if (iterator == index.end()) return 0;
-			return iterator->second->size();
+			return index.count(key);
 		}		
 	
 		//Determine the maximum RAM that would be required given a sequence size and a seed value
 		int memory(long sequence_size, int target_seed)
 		{
+			double keys = min((double)sequence_size, pow(4.0, (double)target_seed));
 			int size_idx = (int)(sequence_size * sizeof(int) / 1000000);
-			int size_seq = (int)(sequence_size * sizeof(char) / 1000000);
-			return size_idx + size_seq;
+			int size_keys = (int)(keys * 2 * sizeof(IndexHash::Slot) / 1000000);
+			return size_idx + size_keys;
 		}
 
 		//Build the index given a DNA sequence
 		void build(string& sequence, int seed, bool bisulfite)
 		{
-			if (seed < 1 || seed > 15)
+			if (seed < 1 || seed > DNA::MAX_KMER)
 			{
-				cerr << "Seed must be between 1 and 15" << endl;
+				cerr << "Seed must be between 1 and " << DNA::MAX_KMER << endl;
 				return;
 			}
 			this->seed = seed;
 			this->bisulfite = bisulfite;
+			this->length = sequence.size();
 			
 			//Generate all index keys from sequence
-			vector<int> indices;
-			DNA::seq2indices(sequence, indices, seed, bisulfite);
-			
-			//Populate index
-			for (int i=0, limit=indices.size(); i<limit; ++i)
-			{
-				if (i%1000000 == 0)
-				{
-					cout << i <<  "\r" << flush;
-				}
-				add(indices[i], i);
-			}
-			indices.clear();
-		}
-		
-		//Add an entry to the index
-		void add(int key, int value)
-		{
-			if (key < 0 || value < 0) return;
-			
-			if (count(key) == 0)
-			{
-				index[key] = new list<int>;
-			}
-			index[key]->push_back(value);
+			vector<DNA::Kmer> keys;
+			DNA::seq2keys(sequence, keys, seed, bisulfite);
+			index.build(keys);
 		}
 	
-		//Get the list of the values in the index for a specified key
-		list<int>* lookup(int key)
+		//Get the values in the index for a specified key. Returns the number of values
+		int lookup(DNA::Kmer key, const int*& values)
 		{
-			if (key < 0) return NULL;
-			iterator.find(key);
-			if (iterator == index.end()) return NULL;
-			return iterator->second;
+			return index.lookup(key, values);
 		}			
 	
 		//Map a read to the index
 		void map_read(Read& read)
 		{
-			list<int>* locations;
-			list<int>::iterator it;
+			const int* locations;
 			
 			for (int i=0; i<read.length; ++i)
 			{
-				locations = lookup(read.indices[i].val);
+				int count = lookup(read.index_at(i).key, locations);
 				
-				if (locations == NULL)
+				if (count == 0)
 				{
 					if (read.mismatches == 0) return;
 					continue;
 				}
 				
-				int pos_read = read.indices[i].pos;
+				int pos_read = read.index_at(i).pos;
 		
-				for (it = locations->begin(); it != locations->end(); ++it)
+				for (int p=0; p<count; ++p)
 				{
-					long pos_genome = *it - pos_read;
+					long pos_genome = locations[p] - pos_read;
 					
-					if (pos_genome < 0 || pos_genome + length > s.length)
+					if (pos_genome < 0 || pos_genome + read.length > length)
 					{
 						continue;
 					}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include "_dna.h"
+
+using namespace std;
+
+/**
+ * Sparse seed index for long seeds (beyond what 4^seed tables allow)
+ * The distinct k-mers are kept as one sorted key array with an offset into a
+ * contiguous position array. Lookup is an interpolation search over the keys,
+ * finishing with a binary search once the range is small or the guesses stop
+ * converging. Memory is 12 bytes per distinct k-mer plus 4 bytes per position.
+ */
+namespace ReadSlam
+{
+	struct IndexSparse
+	{
+		typedef DNA::Kmer Kmer;
+
+		vector<Kmer> keys;      //Distinct keys, ascending
+		vector<int>  offsets;   //Start of each key's positions (one extra entry marks the end)
+		vector<int>  positions; //Positions grouped by key, ascending within a key
+
+		 IndexSparse() { clear(); }
+		~IndexSparse() { clear(); }
+
+		void clear()
+		{
+			vector<Kmer>().swap(keys);
+			vector<int>().swap(offsets);
+			vector<int>().swap(positions);
+		}
+
+		bool empty()
+		{
+			return keys.empty();
+		}
+
+		//Bytes of memory used
+		long memory()
+		{
+			return keys.capacity() * sizeof(Kmer) + (offsets.capacity() + positions.capacity()) * sizeof(int);
+		}
+
+		//Orders positions by their key, then by position
+		struct ByKey
+		{
+			const vector<Kmer>* keys;
+
+			bool operator() (int a, int b) const
+			{
+				Kmer ka = (*keys)[a];
+				Kmer kb = (*keys)[b];
+				return ka == kb ? a < b : ka < kb;
+			}
+		};
+
+		//Build from a vector of keys, one per position (NO_KMER entries are not indexed)
+		void build(const vector<Kmer>& all)
+		{
+			clear();
+
+			long total = 0;
+
+			for (size_t i=0, len=all.size(); i<len; ++i)
+			{
+				if (all[i] != DNA::NO_KMER) total++;
+			}
+			positions.reserve(total);
+
+			for (size_t i=0, len=all.size(); i<len; ++i)
+			{
+				if (all[i] != DNA::NO_KMER) positions.push_back(i);
+			}
+
+			ByKey order;
+			order.keys = &all;
+			sort(positions.begin(), positions.end(), order);
+
+			//Collapse into distinct keys
+			for (long i=0; i<total; ++i)
+			{
+				Kmer key = all[positions[i]];
+
+				if (keys.empty() || keys.back() != key)
+				{
+					keys.push_back(key);
+					offsets.push_back(i);
+				}
+			}
+			offsets.push_back(total);
+
+			vector<Kmer>(keys).swap(keys);
+			vector<int>(offsets).swap(offsets);
+		}
+
+		//Find the positions for a key. Returns the number of positions (0 if the key is absent)
+		int lookup(Kmer key, const int*& hits)
+		{
+			long i = find(key);
+			if (i == -1) return 0;
+
+			hits = &(positions[offsets[i]]);
+			return offsets[i+1] - offsets[i];
+		}
+
+		//Index of a key in the key array, or -1
+		long find(Kmer key)
+		{
+			if (key == DNA::NO_KMER || keys.empty()) return -1;
+
+			long lo = 0;
+			long hi = keys.size() - 1;
+
+			if (key < keys[lo] || key > keys[hi]) return -1;
+
+			//Interpolate while the range is large (k-mer keys are spread fairly evenly)
+			for (int step=0; step<8 && hi - lo > 64; ++step)
+			{
+				double fraction = (double)(key - keys[lo]) / (double)(keys[hi] - keys[lo]);
+				long mid = lo + (long)(fraction * (hi - lo));
+
+				if (mid < lo) mid = lo;
+				if (mid > hi) mid = hi;
+
+				if (keys[mid] == key) return mid;
+				if (keys[mid] < key) lo = mid + 1;
+				else hi = mid - 1;
+
+				if (lo > hi) return -1;
+			}
+
+			//Binary search the rest
+			while (lo <= hi)
+			{
+				long mid = lo + (hi - lo) / 2;
+
+				if (keys[mid] == key) return mid;
+				if (keys[mid] < key) lo = mid + 1;
+				else hi = mid - 1;
+			}
+			return -1;
+		}
+	};
+}
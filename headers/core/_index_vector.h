@@ -26,28 +26,47 @@ namespace ReadSlam
 
 		 IndexVector() { clear(); }
 		~IndexVector() { clear(); }
-		/*
-		//Load the index from disk
-		void load(string infile)
+		//Load the index from disk (as written by save)
+		bool load(string infile)
 		{
 			clear();
 			
-			ifstream in (infile.c_str(), ios::in | ios::binary | ios::ate);
+			ifstream in (infile.c_str(), ios::in | ios::binary);
 			
-			if (in.good())
+			if (!in.good())
 			{
-				int size = in.tellg() / 3;
-				
-				index.resize(size);
-				counts.resize(size);
-				offsets.resize(size);
-				
-				in.seekg(0, ios::beg);
-				in.read((char*)index, size);
-				in.read((char*)counts, size);
-				in.read((char*)offsets, size);
+				cerr << "Unable to open index file " << infile << endl;
+				return false;
 			}
-		    in.close();
+			int flag = 0;
+			in.read((char*)&seed, sizeof(int));
+			in.read((char*)&flag, sizeof(int));
+			in.read((char*)&max, sizeof(int));
+			in.read((char*)&length, sizeof(int));
+			bisulfite = flag == 1;
+			
+			if (!in.good() || seed < 1 || seed > 15 || max != (int)pow((double)4, (double)seed) || length < 0)
+			{
+				cerr << "Bad index file header in " << infile << endl;
+				clear();
+				return false;
+			}
+			index.resize(length);
+			counts.resize(max);
+			offsets.resize(max);
+			
+			if (length > 0) in.read((char*)&(index[0]), length * sizeof(int));
+			in.read((char*)&(counts[0]), max * sizeof(int));
+			in.read((char*)&(offsets[0]), max * sizeof(int));
+			
+			if (!in.good())
+			{
+				cerr << "Index file " << infile << " is truncated" << endl;
+				clear();
+				return false;
+			}
+			in.close();
+			return true;
 		}
 	
 		//Save the index to disk
@@ -55,17 +74,23 @@ namespace ReadSlam
 		{
 			ofstream out (outfile.c_str(), ios::out | ios::binary);
 			
-			int size = index.size();
-			
-			if (out.good())
+			if (!out.good())
 			{
-				out.write((const char*)index, size);
-				out.write((const char*)counts, size);
-				out.write((const char*)offsets, size);
+				cerr << "Unable to open index file " << outfile << endl;
+				return;
 			}
-		    out.close();
+			int flag = bisulfite ? 1 : 0;
+			out.write((const char*)&seed, sizeof(int));
+			out.write((const char*)&flag, sizeof(int));
+			out.write((const char*)&max, sizeof(int));
+			out.write((const char*)&length, sizeof(int));
+			
+			if (length > 0) out.write((const char*)&(index[0]), length * sizeof(int));
+			out.write((const char*)&(counts[0]), max * sizeof(int));
+			out.write((const char*)&(offsets[0]), max * sizeof(int));
+			out.close();
 		}
-		*/
+		
 		//Clear the index
 		void clear()
 		{
@@ -75,6 +100,7 @@ namespace ReadSlam
 
 			max = 0;
 			seed = 0;
+			length = 0;
 			bisulfite = false;
 		}
 		
@@ -190,7 +216,7 @@ namespace ReadSlam
 		{
 			for (int i=0; i<read.length; ++i)
 			{
-				int idx = read.indices[i].val;
+				int idx = read.index_at(i).val;
 				if (idx == -1) continue;
 
 				int count = counts[idx];
@@ -200,7 +226,7 @@ namespace ReadSlam
 					continue;
 				}
 				int offset = offsets[idx];
-				int pos_read = read.indices[i].pos;
+				int pos_read = read.index_at(i).pos;
 
 				for (int p=0; p<count; ++p)
 				{
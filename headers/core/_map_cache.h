@@ -0,0 +1,134 @@
+#pragma once
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Bounded cache of mapping results keyed by read sequence, shared by the
+ * mapping threads. Libraries with heavy duplication (bisulfite, small RNA,
+ * amplicons) map the same sequence many times over; a duplicate takes the best
+ * hit of the first copy and only rescores it with its own qualities.
+ *
+ * Which seeds a read tries first depends on its qualities, so a result only
+ * carries over to a copy with different qualities when it is an exact match
+ * (every exact hit is found whatever the qualities). Other results are reused
+ * by copies with the same qualities, so the output never depends on which
+ * copy was mapped first.
+ *
+ * Slots are direct mapped (a new sequence replaces whatever shared its slot),
+ * so the memory is fixed at 2^bits entries. Slots are guarded by a set of
+ * striped locks rather than one lock per slot.
+ */
+namespace ReadSlam
+{
+	struct MapCache
+	{
+		static const int STRIPES = 64;
+
+		struct Entry
+		{
+			string sequence;
+			string qualities;
+			int  assembly;  //Index of the assembly of the best hit
+			bool forward;
+			long pos;       //Position of the best hit on its strand
+			int  locations; //Number of equally good hits (0 if the read did not map)
+			int  mismatches;
+
+			//The result holds for a copy of the sequence with these qualities
+			bool reusable(const string& quals) const
+			{
+				return (locations > 0 && mismatches == 0) || qualities == quals;
+			}
+		};
+
+		vector<Entry> entries;
+		vector<unsigned long long> hashes; //Hash of each slot's sequence (0 if empty)
+		unsigned long long mask;
+		pthread_mutex_t locks[STRIPES];
+
+		MapCache()
+		{
+			mask = 0;
+			for (int i=0; i<STRIPES; ++i) pthread_mutex_init(&(locks[i]), NULL);
+		}
+		~MapCache()
+		{
+			clear();
+			for (int i=0; i<STRIPES; ++i) pthread_mutex_destroy(&(locks[i]));
+		}
+
+		void clear()
+		{
+			vector<Entry>().swap(entries);
+			vector<unsigned long long>().swap(hashes);
+			mask = 0;
+		}
+
+		//Empty the cache and size it to 2^bits slots (0 turns it off)
+		void init(int bits)
+		{
+			clear();
+			if (bits <= 0) return;
+
+			entries.resize(1ULL << bits);
+			hashes.assign(1ULL << bits, 0);
+			mask = (1ULL << bits) - 1;
+		}
+
+		bool enabled()
+		{
+			return !entries.empty();
+		}
+
+		//FNV-1a hash of a sequence, optionally continuing another hash (never 0, which marks an empty slot)
+		static unsigned long long hash(const string& sequence, unsigned long long h = 14695981039346656037ULL)
+		{
+			for (size_t i=0, len=sequence.size(); i<len; ++i)
+			{
+				h ^= (unsigned char)sequence[i];
+				h *= 1099511628211ULL;
+			}
+			return h == 0 ? 1 : h;
+		}
+
+		//Copy out the entry for a sequence. Returns false if it is not cached
+		bool find(const string& sequence, Entry& out)
+		{
+			if (!enabled()) return false;
+
+			unsigned long long h = hash(sequence);
+			unsigned long long slot = h & mask;
+			bool found = false;
+
+			pthread_mutex_lock(&(locks[slot % STRIPES]));
+
+			if (hashes[slot] == h && entries[slot].sequence == sequence)
+			{
+				out = entries[slot];
+				found = true;
+			}
+			pthread_mutex_unlock(&(locks[slot % STRIPES]));
+			return found;
+		}
+
+		//Cache the result for a sequence, replacing whatever was in its slot
+		void store(const Entry& entry)
+		{
+			if (!enabled()) return;
+
+			unsigned long long h = hash(entry.sequence);
+			unsigned long long slot = h & mask;
+
+			pthread_mutex_lock(&(locks[slot % STRIPES]));
+
+			hashes[slot] = h;
+			entries[slot] = entry;
+
+			pthread_mutex_unlock(&(locks[slot % STRIPES]));
+		}
+	};
+}
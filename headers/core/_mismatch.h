@@ -0,0 +1,131 @@
+#pragma once
+
+#include <immintrin.h>
+
+/**
+ * Quality weighted mismatch tally between a read and a reference window, as used
+ * by Read::align. Bases are compared from the 3' end, and in bisulfite mode a read
+ * T over a reference C is not a mismatch. The tally stops as soon as it exceeds
+ * the score limit (the return value is then only known to be > limit).
+ *
+ * The AVX2 and SSE4.2 kernels compare 32/16 bases per step, build the C->T
+ * tolerance as a mask and sum the qualities of the mismatching bases with SAD.
+ * The kernel is picked once at runtime, so the code does not need -mavx2.
+ */
+namespace Mismatch
+{
+	typedef int (*Kernel)(const char*, const char*, const char*, int, bool, int, int&);
+
+	//One base at a time (also used for the 5' remainder by the vector kernels)
+	static inline int tally_scalar(const char* read, const char* ref, const char* qual, int length, bool bs, int limit, int& fails)
+	{
+		int tally = 0;
+		fails = 0;
+
+		for (int i=length-1; i>=0; --i)
+		{
+			if (read[i] == ref[i]) continue;
+			if (bs && ref[i] == 'C' && read[i] == 'T') continue;
+
+			tally += qual[i];
+
+			if (tally > limit) return tally;
+			fails++;
+		}
+		return tally;
+	}
+
+	__attribute__((target("sse4.2")))
+	static int tally_sse(const char* read, const char* ref, const char* qual, int length, bool bs, int limit, int& fails)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i cs = _mm_set1_epi8('C');
+		const __m128i ts = _mm_set1_epi8('T');
+
+		int tally = 0;
+		int count = 0;
+		int i = length;
+
+		for (; i >= 16; i -= 16)
+		{
+			__m128i r = _mm_loadu_si128((const __m128i*)(read + i - 16));
+			__m128i g = _mm_loadu_si128((const __m128i*)(ref + i - 16));
+			__m128i q = _mm_loadu_si128((const __m128i*)(qual + i - 16));
+
+			__m128i ok = _mm_cmpeq_epi8(r, g);
+
+			if (bs)
+			{
+				ok = _mm_or_si128(ok, _mm_and_si128(_mm_cmpeq_epi8(g, cs), _mm_cmpeq_epi8(r, ts)));
+			}
+			unsigned int bad = ~_mm_movemask_epi8(ok) & 0xFFFF;
+			if (bad == 0) continue;
+
+			__m128i sums = _mm_sad_epu8(_mm_andnot_si128(ok, q), zero);
+			tally += _mm_cvtsi128_si32(sums) + _mm_extract_epi16(sums, 4);
+			count += __builtin_popcount(bad);
+
+			if (tally > limit) return tally;
+		}
+		int rest = 0;
+		tally += tally_scalar(read, ref, qual, i, bs, limit - tally, rest);
+		fails = count + rest;
+		return tally;
+	}
+
+	__attribute__((target("avx2")))
+	static int tally_avx2(const char* read, const char* ref, const char* qual, int length, bool bs, int limit, int& fails)
+	{
+		const __m256i zero = _mm256_setzero_si256();
+		const __m256i cs = _mm256_set1_epi8('C');
+		const __m256i ts = _mm256_set1_epi8('T');
+
+		int tally = 0;
+		int count = 0;
+		int i = length;
+
+		for (; i >= 32; i -= 32)
+		{
+			__m256i r = _mm256_loadu_si256((const __m256i*)(read + i - 32));
+			__m256i g = _mm256_loadu_si256((const __m256i*)(ref + i - 32));
+			__m256i q = _mm256_loadu_si256((const __m256i*)(qual + i - 32));
+
+			__m256i ok = _mm256_cmpeq_epi8(r, g);
+
+			if (bs)
+			{
+				ok = _mm256_or_si256(ok, _mm256_and_si256(_mm256_cmpeq_epi8(g, cs), _mm256_cmpeq_epi8(r, ts)));
+			}
+			unsigned int bad = ~(unsigned int)_mm256_movemask_epi8(ok);
+			if (bad == 0) continue;
+
+			__m256i sums = _mm256_sad_epu8(_mm256_andnot_si256(ok, q), zero);
+			__m128i half = _mm_add_epi64(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+			tally += _mm_cvtsi128_si32(half) + _mm_extract_epi16(half, 4);
+			count += __builtin_popcount(bad);
+
+			if (tally > limit) return tally;
+		}
+		int rest = 0;
+		tally += tally_sse(read, ref, qual, i, bs, limit - tally, rest);
+		fails = count + rest;
+		return tally;
+	}
+
+	//Pick the best kernel for this CPU
+	static Kernel select()
+	{
+		__builtin_cpu_init();
+
+		if (__builtin_cpu_supports("avx2"))   return tally_avx2;
+		if (__builtin_cpu_supports("sse4.2")) return tally_sse;
+		return tally_scalar;
+	}
+
+	//Tally the mismatches of a read against a reference window
+	static inline int tally(const char* read, const char* ref, const char* qual, int length, bool bs, int limit, int& fails)
+	{
+		static const Kernel kernel = select();
+		return kernel(read, ref, qual, length, bs, limit, fails);
+	}
+}
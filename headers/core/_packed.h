@@ -0,0 +1,265 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include "_dna.h"
+
+using namespace std;
+
+/**
+ * A reference sequence stored at 2 bits per base (A=0, C=1, G=2, T=3)
+ * Anything that is not an upper case A, C, G or T is an N. Ns are stored as A in
+ * the packed bases and recorded separately as a sorted list of runs, so whole
+ * chromosome arms of Ns cost a few bytes.
+ */
+namespace ReadSlam
+{
+	struct PackedSequence
+	{
+		struct Run
+		{
+			long start;
+			long length;
+		};
+
+		vector<unsigned char> bases; //4 bases per byte, first base in the low bits
+		vector<Run> masked;          //Runs of N, sorted by start
+		long length;
+
+		 PackedSequence() { clear(); }
+		~PackedSequence() { clear(); }
+
+		void clear()
+		{
+			vector<unsigned char>().swap(bases);
+			vector<Run>().swap(masked);
+			length = 0;
+		}
+
+		void swap(PackedSequence& other)
+		{
+			bases.swap(other.bases);
+			masked.swap(other.masked);
+			std::swap(length, other.length);
+		}
+
+		//Bytes of memory used
+		long memory()
+		{
+			return bases.capacity() + masked.capacity() * sizeof(Run);
+		}
+
+		//Append bases to the end of the sequence
+		void append(const string& dna)
+		{
+			for (size_t i=0, len=dna.size(); i<len; ++i)
+			{
+				int code = 0;
+
+				switch (dna[i])
+				{
+					case 'A' : code = 0; break;
+					case 'C' : code = 1; break;
+					case 'G' : code = 2; break;
+					case 'T' : code = 3; break;
+					default  : mask(length); break;
+				}
+				if ((length & 3) == 0)
+				{
+					bases.push_back(0);
+				}
+				bases[length >> 2] |= code << ((length & 3) << 1);
+				++length;
+			}
+		}
+
+		//Replace the sequence
+		void assign(const string& dna)
+		{
+			clear();
+			bases.reserve((dna.size() + 3) / 4);
+			append(dna);
+		}
+
+		//Load the next record from a FastA stream without holding it unpacked. Returns false at the end of the stream
+		bool load(ifstream& in, string& name)
+		{
+			clear();
+			name.clear();
+
+			string line;
+
+			//Skip to the next header
+			while (in.peek() != '>')
+			{
+				if (!getline(in, line)) return false;
+			}
+			getline(in, name);
+			name = name.substr(1);
+
+			while (in.peek() != '>' && getline(in, line))
+			{
+				append(line);
+			}
+			return true;
+		}
+
+		//The base at a position
+		char at(long pos)
+		{
+			if (is_masked(pos)) return 'N';
+			return "ACGT"[(bases[pos >> 2] >> ((pos & 3) << 1)) & 3];
+		}
+
+		//True if a position is an N
+		bool is_masked(long pos)
+		{
+			int i = first_run(pos);
+			return i < (int)masked.size() && masked[i].start <= pos;
+		}
+
+		//Decode a window of the forward strand into a buffer (which must hold len chars)
+		void extract(long pos, long len, char* out)
+		{
+			static const char* LETTERS = "ACGT";
+			long end = pos + len;
+			long i = pos;
+			char* o = out;
+
+			//Bases up to a byte boundary
+			for (; i < end && (i & 3) != 0; ++i)
+			{
+				*(o++) = LETTERS[(bases[i >> 2] >> ((i & 3) << 1)) & 3];
+			}
+
+			//Whole bytes
+			for (; i + 4 <= end; i += 4)
+			{
+				unsigned char b = bases[i >> 2];
+				o[0] = LETTERS[b & 3];
+				o[1] = LETTERS[(b >> 2) & 3];
+				o[2] = LETTERS[(b >> 4) & 3];
+				o[3] = LETTERS[(b >> 6) & 3];
+				o += 4;
+			}
+
+			//Trailing bases
+			for (; i < end; ++i)
+			{
+				*(o++) = LETTERS[(bases[i >> 2] >> ((i & 3) << 1)) & 3];
+			}
+
+			//Overlay the Ns
+			for (int r = first_run(pos), limit = masked.size(); r < limit && masked[r].start < end; ++r)
+			{
+				long a = max(masked[r].start, pos);
+				long b = min(masked[r].start + masked[r].length, end);
+
+				for (long j=a; j<b; ++j)
+				{
+					out[j - pos] = 'N';
+				}
+			}
+		}
+
+		//Ask for the bytes of a window to be brought into cache ahead of an extract (the addressing is the same)
+		void prefetch(long pos, long len, bool forward)
+		{
+			if (!forward) pos = length - pos - len;
+
+			const unsigned char* first = &(bases[0]) + (pos >> 2);
+			const unsigned char* last = &(bases[0]) + ((pos + len - 1) >> 2);
+
+			for (const unsigned char* p = first; p <= last; p += 64)
+			{
+				__builtin_prefetch(p);
+			}
+			__builtin_prefetch(last);
+		}
+
+		//Decode a window of either strand. Reverse strand windows are addressed in reverse strand coordinates
+		void extract(long pos, long len, char* out, bool forward)
+		{
+			if (forward)
+			{
+				extract(pos, len, out);
+				return;
+			}
+			extract(length - pos - len, len, out);
+			DNA::reverse_complement(out, len);
+		}
+
+		//Decode a window into a string
+		string substr(long pos, long len)
+		{
+			if (pos + len > length) len = length - pos;
+			if (len <= 0) return "";
+
+			string s (len, 'N');
+			extract(pos, len, &(s[0]));
+			return s;
+		}
+
+		//Decode a whole strand
+		void unpack(string& out, bool forward)
+		{
+			out.resize(length);
+			if (length > 0) extract(0, length, &(out[0]), forward);
+		}
+
+		//FNV-1a hash of the packed bases and the N runs (used to check an index against its reference)
+		unsigned long long checksum()
+		{
+			unsigned long long hash = 14695981039346656037ULL;
+
+			for (size_t i=0, len=bases.size(); i<len; ++i)
+			{
+				hash ^= bases[i];
+				hash *= 1099511628211ULL;
+			}
+			for (size_t i=0, len=masked.size(); i<len; ++i)
+			{
+				hash ^= (unsigned long long)masked[i].start;
+				hash *= 1099511628211ULL;
+				hash ^= (unsigned long long)masked[i].length;
+				hash *= 1099511628211ULL;
+			}
+			return hash;
+		}
+
+		//Index of the first run that ends after a position
+		private: int first_run(long pos)
+		{
+			int lo = 0;
+			int hi = masked.size();
+
+			while (lo < hi)
+			{
+				int mid = (lo + hi) / 2;
+
+				if (masked[mid].start + masked[mid].length <= pos) lo = mid + 1;
+				else hi = mid;
+			}
+			return lo;
+		}
+
+		//Record an N at a position (positions arrive in order, so extend the last run if possible)
+		private: void mask(long pos)
+		{
+			if (!masked.empty())
+			{
+				Run& last = masked.back();
+
+				if (last.start + last.length == pos)
+				{
+					last.length++;
+					return;
+				}
+			}
+			Run r = { pos, 1 };
+			masked.push_back(r);
+		}
+	};
+}
@@ -8,23 +8,50 @@
 #include "../common/_common.h"
 #include "_dna.h"
 #include "_sequence.h"
+#include "_mismatch.h"
 
 namespace ReadSlam
 {			
 	struct ReadIndex
 	{
-		int val;
+		int val;        //Key for the vector index (-1 if none, or the seed is too large for it)
+		DNA::Kmer key;  //Key for the hash and sparse indices (NO_KMER if none)
+		int rval;       //Keys of the same seed on the reverse complement of the read
+		DNA::Kmer rkey; //(only built when the reverse strand shares the forward strand index)
 		int pos;
 		int min;
 		int gs;
+		bool masked;    //The seed is a high-frequency k-mer (see RepeatMask), so it is only tried last
 	};
 	
-	static bool compare_index(ReadIndex a, ReadIndex b)
+	//Seeds that tie are left in the order std::sort puts them in (see Read::order)
+	static bool compare_index(const ReadIndex& a, const ReadIndex& b)
 	{
+		if (a.masked != b.masked) return b.masked;
 		if (a.min == b.min) return b.gs < a.gs;
 		return b.min < a.min;
 	}
 	
+	//Working buffers for building a read's seeds. They can be shared by the reads a thread maps (see Read::buffers),
+	//so they are not allocated again for every read
+	struct SeedBuffers
+	{
+		vector<int> vals;
+		vector<DNA::Kmer> keys;
+		vector<int> rc_vals;
+		vector<DNA::Kmer> rc_keys;
+		string reversed;
+		vector<int> window; //Sliding window minimum of the qualities
+		
+		//For the genome-wide index (see Genome::search_global): the search each assembly was last searched by, so
+		//they do not have to be cleared for every search, and a seed's hits on one assembly
+		vector<unsigned int> searched;
+		unsigned int search;
+		vector<int> local;
+		
+		SeedBuffers() { search = 0; }
+	};
+	
 	struct Read
 	{
 		string name;
@@ -41,9 +68,33 @@ namespace ReadSlam
 		int locations;
 		int position;
 		int seed;
+		bool unique_only; //Only unique alignments are wanted, so the search ends once the read cannot be unique (see settled)
+		int aligned;      //Candidates verified while mapping
+		
+		//How many candidates ahead the reference window is prefetched
+		static const int PREFETCH = 8;
 			
-		//Indices, sorted by the highest minimum
+		//Indices, sorted by the highest minimum once the search first asks for one (see index_at)
 		vector<ReadIndex> indices;
+		bool ordered;
+		
+		//Buffers for building the indices: shared ones if the mapper sets them, otherwise the read's own
+		SeedBuffers* buffers;
+		SeedBuffers own;
+		
+		//The reference bases for the candidate being aligned
+		string reference;
+		
+		//The non-overlapping seeds, for the exact match pass (see search_exact)
+		vector<ReadIndex> tiles;
+		
+		//Diagonals (genome positions) already verified on the strand being searched, ascending (pigeonhole search)
+		vector<long> verified;
+		vector<long> candidates;
+		vector<long> merged;
+		
+		//Positions decoded from a compressed vector index (see Sequence::positions)
+		vector<int> decoded;
 		
 		 Read() { clear(); }
 		~Read() { clear(); }
@@ -65,8 +116,12 @@ namespace ReadSlam
 			length = 0;
 			score  = numeric_limits<int>::max();
 			seed = 0;
+			unique_only = false;
+			aligned = 0;
 			
 			indices.clear();
+			ordered = false;
+			buffers = NULL;
 		}
 		
 		bool load(ifstream& in)
@@ -172,7 +227,7 @@ namespace ReadSlam
 			
 			for (int i=0; i<indices.size(); i++)
 			{
-				cout << indices[i].pos << "\t" << indices[i].min << "\t" << indices[i].gs << "\t" << indices[i].val << endl;
+				cout << indices[i].pos << "\t" << indices[i].min << "\t" << indices[i].gs << "\t" << indices[i].key << endl;
 			}
 		}
 		
@@ -192,45 +247,203 @@ namespace ReadSlam
 			}
 		}
 		
-		//Build the indices for this read
-		void build_indices(int seed, bool bisulfite)
+		//Build the indices for this read. With a single strand index the reverse complement keys are built too
+		//Seeds in the repeat mask (if given) are sorted after all of the others
+		//The lowest quality and G count of each seed are kept up to date as the window slides along the read, and
+		//the indices are only put in order when the search reaches them (see index_at)
+		void build_indices(int seed, bool bisulfite, bool single = false, const RepeatMask* repeats = NULL, int window = 0)
 		{
 			this->bisulfite = bisulfite;
 			this->seed = seed;
-
-			vector<int> raw_indices;
-			DNA::seq2indices(sequence, raw_indices, seed, bisulfite);
+			aligned = 0;
+			
+			SeedBuffers& b = scratch();
+			build_keys(b, single);
+			
+			if (window > 1)
+			{
+				sample_keys(b, single, window);
+			}
 			
 			indices.resize(length);
-
+			
+			int head = 0;
+			int tail = 0;
+			int gs = 0;
+			
+			if ((int)b.window.size() < length) b.window.resize(length);
+			
 			for (int i=0; i<length; ++i)
 			{
-				indices[i].val = raw_indices[i];
+				indices[i].val = b.vals[i];
+				indices[i].key = b.keys[i];
+				indices[i].rval = -1;
+				indices[i].rkey = DNA::NO_KMER;
 				indices[i].pos = i;
-				indices[i].min = qualities[i];
+				indices[i].min = 0;
 				indices[i].gs = 0;
+				indices[i].masked = false;
+			}
+			
+			//Slide a window over the read: b.window[head..tail) holds positions of increasing quality, so the lowest
+			//quality in the window is at its head
+			for (int end=0; end<length; ++end)
+			{
+				while (tail > head && qualities[b.window[tail - 1]] >= qualities[end]) tail--;
+				b.window[tail++] = end;
+				
+				if (sequence[end] == 'G') gs++;
+				
+				int i = end - seed + 1;
+				if (i < 0) continue;
 				
-				if (indices[i].val == -1 || i+seed > length)
+				if (b.window[head] < i) head++;
+				
+				//The seed at i covers the reverse complement from length-i-seed
+				if (single)
 				{
-					indices[i].min = 0;
-					continue;
+					indices[i].rval = b.rc_vals[length - i - seed];
+					indices[i].rkey = b.rc_keys[length - i - seed];
 				}
-				
-				for (int j=0; j<seed; ++j)
+				if (indices[i].key != DNA::NO_KMER || indices[i].rkey != DNA::NO_KMER)
 				{
-					if (sequence[i+j] == 'G')
-					{
-						indices[i].gs++;
-					}
-					if (qualities[i+j] < indices[i].min)
+					indices[i].min = qualities[b.window[head]];
+					indices[i].gs = gs;
+					
+					if (repeats != NULL)
 					{
-						indices[i].min = qualities[i+j];
+						indices[i].masked = repeats->contains(indices[i].key) || repeats->contains(indices[i].rkey);
 					}
 				}
+				if (sequence[i] == 'G') gs--;
 			}
-			
-			//Sort the indices
+			ordered = false;
+		}
+		
+		//The ith best seed
+		inline const ReadIndex& index_at(int i)
+		{
+			if (!ordered) order();
+			return indices[i];
+		}
+		
+		//Tied seeds are tried in the order a full sort leaves them in, which decides the hit a read with several
+		//equally good ones is given, so the seeds are sorted all at once rather than only the best few selected
+		void order()
+		{
 			std::sort(indices.begin(), indices.end(), compare_index);
+			ordered = true;
+		}
+		
+		//Build the keys of the non-overlapping seeds only (no qualities, no sort), for the exact match pass
+		void build_tiles(int seed, bool bisulfite, bool single = false)
+		{
+			this->bisulfite = bisulfite;
+			this->seed = seed;
+			aligned = 0;
+			
+			SeedBuffers& b = scratch();
+			build_keys(b, single);
+			tiles.clear();
+			
+			for (int i=0; i+seed<=length; i+=seed)
+			{
+				if (b.keys[i] == DNA::NO_KMER) continue;
+				
+				ReadIndex r;
+				r.val = b.vals[i];
+				r.key = b.keys[i];
+				r.rval = single ? b.rc_vals[length - i - seed] : -1;
+				r.rkey = single ? b.rc_keys[length - i - seed] : DNA::NO_KMER;
+				r.pos = i;
+				r.min = 0;
+				r.gs = 0;
+				r.masked = false;
+				tiles.push_back(r);
+			}
+		}
+		
+		//The seed keys of the read, and of its reverse complement with a single strand index
+		void build_keys(SeedBuffers& b, bool single)
+		{
+			seed_keys(sequence, b.vals, b.keys, single && bisulfite);
+			
+			if (single)
+			{
+				b.reversed.assign(sequence);
+				DNA::reverse_complement(&(b.reversed[0]), length);
+				seed_keys(b.reversed, b.rc_vals, b.rc_keys, bisulfite);
+			}
+		}
+		
+		//Drop the seeds that are not minimizers of the read (see DNA::minimizers), as a minimizer-sampled index only has
+		//the others where they are minimizers of the genome too. Windows lie within the read's seeds, so a read with fewer
+		//seeds than a window takes them all as one
+		void sample_keys(SeedBuffers& b, bool single, int window)
+		{
+			int count = length - seed + 1;
+			if (count < 1) return;
+			
+			window = std::min(window, count);
+			DNA::minimizers(&(b.vals[0]), count, window, b.window);
+			
+			for (int i=0; i<count; ++i)
+			{
+				if (b.vals[i] == -1) b.keys[i] = DNA::NO_KMER;
+			}
+			if (!single) return;
+			
+			DNA::minimizers(&(b.rc_vals[0]), count, window, b.window);
+			
+			for (int i=0; i<count; ++i)
+			{
+				if (b.rc_vals[i] == -1) b.rc_keys[i] = DNA::NO_KMER;
+			}
+		}
+		
+		inline SeedBuffers& scratch()
+		{
+			return buffers != NULL ? *buffers : own;
+		}
+		
+		//Dense table indices and 64-bit keys for a sequence. Seeds past the dense table limit only have keys
+		void seed_keys(const string& seq, vector<int>& vals, vector<DNA::Kmer>& keys, bool ry)
+		{
+			int limit = ry ? 30 : 15;
+			
+			if (ry)
+			{
+				DNA::seq2keys_ry(seq, keys, seed);
+			}
+			else if (seed > limit)
+			{
+				DNA::seq2keys(seq, keys, seed, bisulfite);
+			}
+			else
+			{
+				DNA::seq2indices(seq, vals, seed, bisulfite);
+				keys.resize(vals.size());
+				
+				for (size_t i=0, len=vals.size(); i<len; ++i)
+				{
+					keys[i] = vals[i] == -1 ? DNA::NO_KMER : vals[i];
+				}
+				return;
+			}
+			vals.resize(keys.size());
+			
+			for (size_t i=0, len=keys.size(); i<len; ++i)
+			{
+				vals[i] = (keys[i] == DNA::NO_KMER || seed > limit) ? -1 : (int)keys[i];
+			}
+		}
+		
+		//In unique only mode a read is settled (nothing else is searched) once a second hit ties with the best at a score
+		//no other hit can beat. The hits not verified yet (other seeds, strands and assemblies) are bounded by nothing
+		//but 0, so only exact ties settle a read, and a read that is unique in a full search is still found unique
+		inline bool settled()
+		{
+			return unique_only && locations > 1 && score <= 0;
 		}
 		
 		//Search using the vector approach
@@ -238,76 +451,302 @@ namespace ReadSlam
 		{
 			for (int i=0; i<length; ++i)
 			{
-				int idx = indices[i].val;
+				const ReadIndex& r = index_at(i);
+				int idx = r.val;
 				if (idx == -1) continue;
 
-				int count = s.index_counts[idx];
+				const int* hits;
+				int count = s.positions(idx, hits, decoded);
 				if (count == 0) continue;
 
-				int offset = s.index_offsets[idx];
-				int pos_read = indices[i].pos;
+				align_hits(s, hits, count, r.pos, false);
+				break;
+			}
+		}
+		
+		//Search the reverse strand through the forward strand's vector index, using the reverse complement keys
+		void search_reverse(Sequence& index, Sequence& s)
+		{
+			for (int i=0; i<length; ++i)
+			{
+				const ReadIndex& r = index_at(i);
+				int idx = r.rval;
+				if (idx == -1) continue;
 
-				for (int p=0; p<count; ++p)
-				{
-					int pos_genome = s.index_sorted[offset + p] - pos_read;
-					
-					if (pos_genome < 0 || pos_genome + length > s.length)
-					{
-						continue;
-					}
-					align(s, pos_genome);
-				}
+				const int* hits;
+				int count = index.positions(idx, hits, decoded);
+				if (count == 0) continue;
+
+				align_hits(s, hits, count, r.pos, true);
 				break;
 			}
 		}
 		
-		//Search using the map approach
+		//Search using the hash or sparse approach
 		void search_map(Sequence& s)
 		{
-			list<int>* locations;
-			list<int>::iterator it;
+			const int* hits;
+			
+			for (int i=0; i<length; ++i)
+			{
+				const ReadIndex& r = index_at(i);
+				int count = s.lookup(r.key, hits);
+				
+				if (count == 0) continue;
+				
+				align_hits(s, hits, count, r.pos, false);
+				break;
+			}
+		}
+		
+		//Search the reverse strand through the forward strand's hash or sparse index
+		void search_map_reverse(Sequence& index, Sequence& s)
+		{
+			const int* hits;
 			
 			for (int i=0; i<length; ++i)
 			{
-				locations = s.lookup(indices[i].val);
+				const ReadIndex& r = index_at(i);
+				int count = index.lookup(r.rkey, hits);
 				
-				if (locations == NULL) continue;
+				if (count == 0) continue;
 				
-				int pos_read = indices[i].pos;
+				align_hits(s, hits, count, r.pos, true);
+				break;
+			}
+		}
 		
-				for (it = locations->begin(); it != locations->end(); it++ )
+		//Search with non-overlapping seeds (the read tiled from its start, best seeds first). By the pigeonhole
+		//principle an alignment with up to k mismatches matches one of any k+1 disjoint seeds exactly, so up to
+		//k+1 seeds are searched. Each diagonal is verified once however many seeds hit it. An alignment that has
+		//not been found has a mismatch in every seed searched, so once the lowest qualities of those seeds add up
+		//to more than the best score, the best and second best alignments on this strand are settled. If they are
+		//not, the first seed that hits is searched as well (as in search), so nothing search finds is missed.
+		//Mirrored searches look up the reverse complement keys in the forward strand index (see search_reverse)
+		void search_pigeonhole(Sequence& index, Sequence& s, bool usemap, bool mirror, int mismatches)
+		{
+			verified.clear();
+			
+			int bound = 0;
+			int searched = 0;
+			const int* hits = NULL;
+			
+			for (int i=0; i<length && searched <= mismatches; ++i)
+			{
+				const ReadIndex& r = index_at(i);
+				
+				if (!tiled(r)) continue;
+				
+				searched++;
+				
+				int count = seed_hits(index, r, usemap, mirror, hits);
+				
+				if (count > 0)
 				{
-					long pos_genome = *it - pos_read;
-					
-					if (pos_genome < 0 || pos_genome + length > s.length)
-					{
-						continue;
-					}
-					align(s, pos_genome);
+					align_new(s, hits, count, r.pos, mirror);
+				}
+				
+				bound += r.min;
+				if (bound > score || settled()) return;
+			}
+			
+			//Not settled, so also try the best seed that hits (unless it was one of the tiles)
+			for (int i=0, tiles=0; i<length; ++i)
+			{
+				const ReadIndex& r = index_at(i);
+				
+				if (tiled(r) && ++tiles <= searched)
+				{
+					if (seed_count(index, r, usemap, mirror) > 0) return;
+					continue;
+				}
+				
+				int count = seed_hits(index, r, usemap, mirror, hits);
+				
+				if (count > 0)
+				{
+					align_new(s, hits, count, r.pos, mirror);
+					return;
 				}
-				break;
 			}
 		}
 		
-		//Specific alignment of read to reference sequence
-		void align(Sequence& s, long pos)
+		//Align the exact matches on a strand, returning how many there are. An exact match contains every tile, so only
+		//the hits of the rarest tile are checked, and a tile with no hits at all rules the strand out straight away.
+		//Exact hits are aligned in the same order as the seed search would reach them, so the result is the same
+		//A read without tiles (shorter than the seed, or with an N in each of them) has no exact hits
+		int search_exact(Sequence& index, Sequence& s, bool usemap, bool mirror)
+		{
+			if (tiles.empty()) return 0;
+			
+			int rarest = -1;
+			int fewest = 0;
+			
+			for (int t=0, len=tiles.size(); t<len; ++t)
+			{
+				int count = seed_count(index, tiles[t], usemap, mirror);
+				if (count == 0) return 0;
+				
+				if (rarest == -1 || count < fewest)
+				{
+					rarest = t;
+					fewest = count;
+				}
+			}
+			const int* hits = NULL;
+			seed_hits(index, tiles[rarest], usemap, mirror, hits);
+			
+			int pos_read = tiles[rarest].pos;
+			int found = 0;
+			
+			for (int p=0; p<fewest && !settled(); ++p)
+			{
+				long hit = mirror ? s.length - hits[fewest - 1 - p] - seed : hits[p];
+				long pos_genome = hit - pos_read;
+				
+				if (pos_genome < 0 || pos_genome + length > s.length || !exact(s, pos_genome))
+				{
+					continue;
+				}
+				align(s, pos_genome);
+				found++;
+			}
+			return found;
+		}
+		
+		//No mismatches at all against the reference at a position (the tally stops at the first one)
+		bool exact(Sequence& s, long pos)
 		{
-			int tally = 0;
 			int fails = 0;
+			
+			if ((int)reference.size() < length) reference.resize(length);
+			s.window(pos, length, &(reference[0]));
+			
+			return Mismatch::tally(sequence.data(), reference.data(), qualities.data(), length, bisulfite, 0, fails) == 0;
+		}
 		
-			for (int i=length-1; i>=0; --i)
+		//Seeds at multiples of the seed size do not overlap
+		inline bool tiled(const ReadIndex& r)
+		{
+			return r.pos % seed == 0 && r.pos + seed <= length;
+		}
+		
+		//The index positions of a seed
+		int seed_hits(Sequence& index, const ReadIndex& r, bool usemap, bool mirror, const int*& hits)
+		{
+			if (usemap)
+			{
+				return index.lookup(mirror ? r.rkey : r.key, hits);
+			}
+			int idx = mirror ? r.rval : r.val;
+			if (idx == -1) return 0;
+			
+			return index.positions(idx, hits, decoded);
+		}
+		
+		//The number of index positions of a seed (a compressed index does not decode them)
+		int seed_count(Sequence& index, const ReadIndex& r, bool usemap, bool mirror)
+		{
+			if (usemap)
+			{
+				const int* hits;
+				return index.lookup(mirror ? r.rkey : r.key, hits);
+			}
+			int idx = mirror ? r.rval : r.val;
+			return idx == -1 ? 0 : index.counts[idx];
+		}
+		
+		//Align against the hits of a seed whose diagonals have not been verified yet (hits give ascending diagonals)
+		void align_new(Sequence& s, const int* hits, int count, int pos_read, bool mirror)
+		{
+			candidates.clear();
+			
+			for (int p=0; p<count; ++p)
 			{
-				char charRead = sequence[i];
-				char charRef  = s.sequence[pos+i];
+				long hit = mirror ? s.length - hits[count - 1 - p] - seed : hits[p];
+				long pos_genome = hit - pos_read;
+				
+				if (pos_genome < 0 || pos_genome + length > s.length)
+				{
+					continue;
+				}
+				candidates.push_back(pos_genome);
+			}
+			
+			//Merge into the verified diagonals, aligning the ones that are new
+			merged.clear();
+			size_t v = 0;
 			
-				if (charRead == charRef) continue;
-				if (bisulfite && charRef == 'C' && charRead == 'T') continue;
+			for (size_t c=0, len=candidates.size(); c<len && !settled(); ++c)
+			{
+				if (c + PREFETCH < len) s.prefetch(candidates[c + PREFETCH], length);
 				
-				tally += qualities[i];
+				while (v < verified.size() && verified[v] < candidates[c])
+				{
+					merged.push_back(verified[v++]);
+				}
+				if (v < verified.size() && verified[v] == candidates[c]) continue;
 				
-				if (tally > score) return;
-				fails++;
+				align(s, candidates[c]);
+				merged.push_back(candidates[c]);
 			}
+			merged.insert(merged.end(), verified.begin() + v, verified.end());
+			verified.swap(merged);
+		}
+		
+		//Align against each hit of a seed. Mirrored hits are forward strand positions of the reverse complement
+		//seed, and are walked backwards so the reverse strand positions come out in ascending order
+		//The window of the hit PREFETCH places ahead is requested before each alignment, so its cache miss overlaps the work
+		void align_hits(Sequence& s, const int* hits, int count, int pos_read, bool mirror)
+		{
+			for (int p=0; p<count && !settled(); ++p)
+			{
+				if (p + PREFETCH < count)
+				{
+					long ahead = (mirror ? s.length - hits[count - 1 - p - PREFETCH] - seed : hits[p + PREFETCH]) - pos_read;
+					if (ahead >= 0 && ahead + length <= s.length) s.prefetch(ahead, length);
+				}
+				
+				long hit = mirror ? s.length - hits[count - 1 - p] - seed : hits[p];
+				long pos_genome = hit - pos_read;
+				
+				if (pos_genome < 0 || pos_genome + length > s.length)
+				{
+					continue;
+				}
+				align(s, pos_genome);
+			}
+		}
+		
+		//Take a best hit found for an identical read, scoring it with this read's qualities
+		void place(Sequence& s, long pos, int locations)
+		{
+			if ((int)reference.size() < length) reference.resize(length);
+			s.window(pos, length, &(reference[0]));
+			
+			int fails = 0;
+			
+			this->locations = locations;
+			score      = Mismatch::tally(sequence.data(), reference.data(), qualities.data(), length, bisulfite, numeric_limits<int>::max(), fails);
+			mismatches = fails;
+			assembly   = s.name;
+			forward    = s.forward;
+			position   = s.forward ? pos : s.length - pos - length;
+		}
+		
+		//Specific alignment of read to reference sequence
+		void align(Sequence& s, long pos)
+		{
+			int fails = 0;
+			aligned++;
+			
+			if ((int)reference.size() < length) reference.resize(length);
+			s.window(pos, length, &(reference[0]));
+			
+			//Quality weighted mismatches, 3' end first, giving up once the best score is beaten
+			int tally = Mismatch::tally(sequence.data(), reference.data(), qualities.data(), length, bisulfite, score, fails);
+			
+			if (tally > score) return;
 			
 			//Deal with a multi
 			if (tally == score)
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <pthread.h>
+#include <list>
+#include "_read.h"
+
+/**
+ * Bounded, ordered queue of read batches shared by the mapping threads
+ *
+ * One reader fills empty batches from the input and appends them in input
+ * order. Mapping workers claim small chunks of reads from the oldest batch
+ * that still has unclaimed reads, so a slow chunk never holds up the other
+ * workers and no thread is tied to a fixed share of the input. The writer
+ * takes batches off the front once every read in them is mapped, which keeps
+ * the output in input order, and hands them back to the reader.
+ */
+namespace ReadSlam
+{
+	struct ReadBatch
+	{
+		vector<Read> reads;
+		int  size;    //Reads loaded into the batch
+		int  claimed; //Reads handed out to workers
+		int  mapped;  //Reads finished by workers
+		long number;  //Position of the batch in the input
+	};
+
+	struct ReadQueue
+	{
+		vector<ReadBatch> batches;
+		list<ReadBatch*> empty;  //Batches waiting for the reader
+		list<ReadBatch*> active; //Loaded batches in input order, waiting to be mapped and written
+		bool finished;           //The reader has reached the end of the input
+		int  chunk;              //Reads claimed by a worker at a time
+
+		pthread_mutex_t lock;
+		pthread_cond_t  changed;
+
+		 ReadQueue() { pthread_mutex_init(&lock, NULL); pthread_cond_init(&changed, NULL); }
+		~ReadQueue() { pthread_cond_destroy(&changed); pthread_mutex_destroy(&lock); }
+
+		void init(int depth, int batch_size, int chunk)
+		{
+			this->chunk = chunk;
+			finished = false;
+			empty.clear();
+			active.clear();
+			batches.resize(depth);
+
+			for (int i=0; i<depth; ++i)
+			{
+				batches[i].reads.resize(batch_size);
+				batches[i].size = 0;
+				empty.push_back(&(batches[i]));
+			}
+		}
+
+		//Reader: wait for an empty batch
+		ReadBatch* take()
+		{
+			pthread_mutex_lock(&lock);
+
+			while (empty.empty())
+			{
+				pthread_cond_wait(&changed, &lock);
+			}
+			ReadBatch* batch = empty.front();
+			empty.pop_front();
+
+			pthread_mutex_unlock(&lock);
+			return batch;
+		}
+
+		//Reader: queue a loaded batch
+		void push(ReadBatch* batch, long number)
+		{
+			pthread_mutex_lock(&lock);
+
+			batch->claimed = 0;
+			batch->mapped = 0;
+			batch->number = number;
+			active.push_back(batch);
+
+			pthread_cond_broadcast(&changed);
+			pthread_mutex_unlock(&lock);
+		}
+
+		//Reader: no more batches are coming
+		void finish()
+		{
+			pthread_mutex_lock(&lock);
+			finished = true;
+			pthread_cond_broadcast(&changed);
+			pthread_mutex_unlock(&lock);
+		}
+
+		//Worker: claim the next chunk of reads [start, end). Returns NULL when there is nothing left to map
+		ReadBatch* claim(int& start, int& end)
+		{
+			pthread_mutex_lock(&lock);
+
+			while (true)
+			{
+				for (list<ReadBatch*>::iterator it = active.begin(); it != active.end(); ++it)
+				{
+					ReadBatch* batch = *it;
+
+					if (batch->claimed < batch->size)
+					{
+						start = batch->claimed;
+						end = min(batch->size, start + chunk);
+						batch->claimed = end;
+
+						pthread_mutex_unlock(&lock);
+						return batch;
+					}
+				}
+				if (finished) break;
+				pthread_cond_wait(&changed, &lock);
+			}
+			pthread_mutex_unlock(&lock);
+			return NULL;
+		}
+
+		//Worker: a claimed chunk has been mapped
+		void complete(ReadBatch* batch, int count)
+		{
+			pthread_mutex_lock(&lock);
+
+			batch->mapped += count;
+
+			if (batch->mapped == batch->size && batch == active.front())
+			{
+				pthread_cond_broadcast(&changed);
+			}
+			pthread_mutex_unlock(&lock);
+		}
+
+		//Writer: wait for the oldest batch to be fully mapped. Returns NULL at the end of the input
+		ReadBatch* next()
+		{
+			pthread_mutex_lock(&lock);
+
+			ReadBatch* batch = NULL;
+
+			while (true)
+			{
+				if (!active.empty() && active.front()->mapped == active.front()->size)
+				{
+					batch = active.front();
+					active.pop_front();
+					break;
+				}
+				if (active.empty() && finished) break;
+				pthread_cond_wait(&changed, &lock);
+			}
+			pthread_mutex_unlock(&lock);
+			return batch;
+		}
+
+		//Writer: give a written batch back to the reader
+		void recycle(ReadBatch* batch)
+		{
+			pthread_mutex_lock(&lock);
+			batch->size = 0;
+			empty.push_back(batch);
+			pthread_cond_broadcast(&changed);
+			pthread_mutex_unlock(&lock);
+		}
+	};
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <vector>
+#include "_dna.h"
+
+using namespace std;
+
+/**
+ * Bitset of the k-mers that occur too often to be worth verifying (satellites,
+ * Alus, centromeric repeats). Reads try their other seeds first and only fall
+ * back to a masked seed when none of the others hit.
+ *
+ * This trades sensitivity for a bounded cost: the search stops at the first seed
+ * that hits, so a read whose best alignment is only found through a masked seed
+ * may end up with a worse alignment found through another seed (or be reported
+ * unique when it is not). It is off by default (see Genome::repeat_threshold).
+ *
+ * When the key space fits (2 bits per base, or 1 in the purine/pyrimidine
+ * alphabet, up to 2^MAX_BITS keys) there is one bit per k-mer. Larger seeds
+ * share bits through a hash, so a rare k-mer may occasionally be treated as a
+ * repeat as well.
+ */
+namespace ReadSlam
+{
+	struct RepeatMask
+	{
+		typedef DNA::Kmer Kmer;
+		static const int MAX_BITS = 27; //16MB
+
+		vector<unsigned long long> bits;
+		int  width;   //log2 of the number of bits
+		bool hashed;  //Keys are hashed into the bitset rather than used directly
+		long masked;  //Number of k-mers added
+
+		 RepeatMask() { clear(); }
+		~RepeatMask() { clear(); }
+
+		void clear()
+		{
+			vector<unsigned long long>().swap(bits);
+			width = 0;
+			hashed = false;
+			masked = 0;
+		}
+
+		//Size the bitset for a seed (ry seeds use one bit per base)
+		void init(int seed, bool ry)
+		{
+			clear();
+
+			int keybits = ry ? seed : 2 * seed;
+
+			hashed = keybits > MAX_BITS;
+			width = hashed ? MAX_BITS : keybits;
+			bits.assign(((1ULL << width) + 63) / 64, 0);
+		}
+
+		bool empty()
+		{
+			return masked == 0;
+		}
+
+		//Bytes of memory used
+		long memory()
+		{
+			return bits.capacity() * sizeof(unsigned long long);
+		}
+
+		void add(Kmer key)
+		{
+			unsigned long long i = slot(key);
+			bits[i / 64] |= 1ULL << (i % 64);
+			masked++;
+		}
+
+		inline bool contains(Kmer key) const
+		{
+			if (masked == 0 || key == DNA::NO_KMER) return false;
+
+			unsigned long long i = slot(key);
+			return (bits[i / 64] >> (i % 64)) & 1;
+		}
+
+		private: inline unsigned long long slot(Kmer key) const
+		{
+			return hashed ? (key * 0x9E3779B97F4A7C15ULL) >> (64 - width) : key;
+		}
+	};
+}
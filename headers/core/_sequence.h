@@ -1,29 +1,49 @@
 #pragma once
 
 #include "_dna.h"
+#include "_packed.h"
+#include "_index_hash.h"
+#include "_index_sparse.h"
+#include "_index_compressed.h"
+#include "_repeat_mask.h"
 #include <map>
+#include <list>
+#include <pthread.h>
 
 /**
  * Represents a single sequence and an index for it
+ * The bases live in a PackedSequence owned by the Assembly. The reverse strand
+ * shares the forward bases and is computed on the fly.
  */
 namespace ReadSlam
 {
 	struct Sequence
 	{
 		string name;
-		string sequence;
+		PackedSequence* reference;
 		int    length;
 		bool   forward;
 		bool   bisulfite;
+		bool   ry;        //Keys use the purine/pyrimidine alphabet (see DNA::seq2keys_ry)
+		long   indexed;   //Positions in the vector index
 	
 		vector<int> index_random;
 		vector<int> index_sorted;
 		vector<int> index_counts;
 		vector<int> index_offsets;
 
-		//The other indexing system
-		map<int, list<int> > index_map;
-		map<int, list<int> >::iterator index_iterator;
+		//The positions coded in far less memory (see compress). The sorted and offsets tables are then NULL
+		IndexCompressed index_compressed;
+
+		//The tables used for searching. These point at the vectors above or into a mapped index file
+		const int* sorted;
+		const int* counts;
+		const int* offsets;
+		long keys;
+
+		//The other indexing systems (keyed by 64-bit k-mers, so seeds can go past 15)
+		IndexHash index_hash;
+		IndexSparse index_sparse;
 		
 		 Sequence() { clear(); }
 		~Sequence() { clear(); }
@@ -31,46 +51,283 @@ namespace ReadSlam
 		void clear()
 		{
 			name.clear();
-			sequence.clear();
+			reference = NULL;
 			index_random.clear();
 			index_sorted.clear();
 			index_counts.clear();
 			index_offsets.clear();
-			index_map.clear();
+			index_compressed.clear();
+			index_hash.clear();
+			index_sparse.clear();
+			detach();
 
 			length    = 0;
 			forward   = true;
 			bisulfite = false;
+			ry        = false;
+			indexed   = 0;
 		}
 		
-		void init(string name, bool forward, string sequence)
+		void init(string name, bool forward, PackedSequence* reference)
 		{
 			this->name = name;
 			this->forward = forward;
-			this->length = sequence.size();
-			this->sequence = forward ? sequence : DNA::reverse_complement(sequence);
+			this->reference = reference;
+			this->length = reference->length;
+		}
+		
+		//Decode a window of this strand into a buffer
+		void window(long pos, long len, char* out)
+		{
+			reference->extract(pos, len, out, forward);
+		}
+		
+		//Start loading a window into cache, so a later window() call does not stall
+		void prefetch(long pos, long len)
+		{
+			reference->prefetch(pos, len, forward);
+		}
+		
+		//The base at a position on this strand
+		char base(long pos)
+		{
+			if (forward) return reference->at(pos);
+			
+			switch (reference->at(length - 1 - pos))
+			{
+				case 'A' : return 'T';
+				case 'T' : return 'A';
+				case 'C' : return 'G';
+				case 'G' : return 'C';
+			}
+			return 'N';
 		}
 		
-		void build_index(int seed, bool bisulfite)
+		//Build the vector index. With more than one thread the positions are first split by the high bits of their
+		//keys into buckets (each thread placing its own chunk of the strand), then the threads take a bucket at a
+		//time and sort its positions by key into the one shared table. The index is the same as the one built by a
+		//single thread
+		//With a window only the (window, seed) minimizers are indexed (see DNA::minimizers)
+		void build_index(int seed, bool bisulfite, bool ry = false, int threads = 1, int window = 0)
 		{
 			this->bisulfite = bisulfite;
+			this->ry = ry;
 			
-			int base = 4;
+			int base = ry ? 2 : 4;
 			int max = (int)pow((double)base, (double)seed);
 		
 			//Initialize index
 			index_random.resize(length,-1);
-			index_sorted.resize(length,-1);
 			index_counts.resize(max,0);
 			index_offsets.resize(max,0);
+			
+			//Populate randomly ordered index
+			{
+				string sequence;
+				reference->unpack(sequence, forward);
+				
+				if (ry)
+				{
+					vector<DNA::Kmer> keys;
+					DNA::seq2keys_ry(sequence, keys, seed);
+					
+					for (int i=0; i<length; ++i)
+					{
+						index_random[i] = keys[i] == DNA::NO_KMER ? -1 : (int)keys[i];
+					}
+				}
+				else
+				{
+					DNA::seq2indices(sequence, index_random, seed, bisulfite);
+				}
+			}
+			if (window > 1 && length > 0)
+			{
+				vector<int> queue;
+				DNA::minimizers(&(index_random[0]), length, window, queue);
+			}
+			indexed = length - std::count(index_random.begin(), index_random.end(), -1);
+			
+			//A sampled index only has room for the positions it keeps (a full one has a slot per base, as the index file expects)
+			index_sorted.resize(window > 1 ? indexed : length, -1);
+			
+			if (threads < 2 || length < MIN_CHUNK)
+			{
+				sort_positions(max);
+			}
+			else
+			{
+				sort_positions(max, threads);
+			}
+			vector<int>().swap(index_random);
+			attach();
+		}
+		
+		//Smallest sequence worth splitting between threads
+		static const int MIN_CHUNK = 1000000;
+		
+		//Key ranges the positions are split into before they are sorted by key (by the high bits of the keys)
+		static const int BUCKETS = 4096;
+		
+		//The state shared by the threads sorting a strand's positions
+		struct IndexSort
+		{
+			Sequence* sequence;
+			int shift;          //Key bits below the bucket bits
+			vector<int> starts; //Where each bucket's positions start in the sorted positions (and where the last ends)
+			volatile int next;  //The next bucket to be sorted
+		};
+		
+		//One thread's share of the positions
+		struct IndexChunk
+		{
+			IndexSort* sort;
+			int first;
+			int last;
+			vector<int> cursors; //Positions of the chunk in each bucket, then where the chunk's next one in each goes
+			vector<int> buffer;  //The positions of the bucket being sorted
+			int pass;            //0 counts the chunk's buckets, 1 places its positions in them, 2 sorts buckets
+		};
+		
+		static void* thread_exec_chunk(void* param)
+		{
+			IndexChunk* chunk = static_cast<IndexChunk*>(param);
+			IndexSort* sort = chunk->sort;
+			Sequence* sequence = sort->sequence;
+			const int* random = &(sequence->index_random[0]);
+			int shift = sort->shift;
+			
+			if (chunk->pass == 0)
+			{
+				for (int i=chunk->first; i<chunk->last; ++i)
+				{
+					if (random[i] != -1) chunk->cursors[random[i] >> shift]++;
+				}
+			}
+			else if (chunk->pass == 1)
+			{
+				int* sorted = &(sequence->index_sorted[0]);
+				
+				for (int i=chunk->first; i<chunk->last; ++i)
+				{
+					if (random[i] != -1) sorted[chunk->cursors[random[i] >> shift]++] = i;
+				}
+			}
+			else
+			{
+				for (int b; (b = __sync_fetch_and_add(&(sort->next), 1)) < (int)sort->starts.size() - 1; )
+				{
+					sequence->sort_bucket(b, *sort, chunk->buffer);
+				}
+			}
+			return NULL;
+		}
+		
+		//Counting sort of the positions by key on several threads
+		void sort_positions(int max, int threads)
+		{
+			IndexSort sort;
+			int buckets = std::min(max, BUCKETS);
+			
+			sort.sequence = this;
+			sort.shift = 0;
+			sort.next = 0;
+			
+			while ((max >> sort.shift) > buckets) sort.shift++;
+			
+			vector<IndexChunk> chunks (threads);
+			vector<pthread_t> workers (threads);
+			
+			for (int t=0; t<threads; ++t)
+			{
+				chunks[t].sort = &sort;
+				chunks[t].first = (long)length * t / threads;
+				chunks[t].last = (long)length * (t + 1) / threads;
+				chunks[t].cursors.assign(buckets, 0);
+				chunks[t].pass = 0;
+			}
+			run_chunks(chunks, workers);
+			
+			//Bucket starts, and each chunk's starting cursors, in chunk order so the positions in a bucket stay ascending
+			sort.starts.resize(buckets + 1);
+			
+			for (int b=0, start=0; b<buckets; ++b)
+			{
+				sort.starts[b] = start;
+				
+				for (int t=0; t<threads; ++t)
+				{
+					int count = chunks[t].cursors[b];
+					chunks[t].cursors[b] = start;
+					start += count;
+				}
+			}
+			sort.starts[buckets] = indexed;
+			
+			for (int t=0; t<threads; ++t)
+			{
+				chunks[t].pass = 1;
+			}
+			run_chunks(chunks, workers);
+			
+			for (int t=0; t<threads; ++t)
+			{
+				chunks[t].pass = 2;
+			}
+			run_chunks(chunks, workers);
+		}
+		
+		//Sort the positions of a bucket by key, in place. Its keys are counted and given their offsets within the
+		//bucket, and its positions (ascending) are placed in the same order, so those of each key stay ascending
+		void sort_bucket(int b, IndexSort& sort, vector<int>& buffer)
+		{
+			int first = sort.starts[b];
+			int last = sort.starts[b + 1];
+			int key_first = b << sort.shift;
+			int key_last = (b + 1) << sort.shift;
+			
+			buffer.assign(index_sorted.begin() + first, index_sorted.begin() + last);
+			
+			for (int i=0, len=buffer.size(); i<len; ++i)
+			{
+				index_counts[index_random[buffer[i]]]++;
+			}
+			for (int k=key_first, offset=first; k<key_last; ++k)
+			{
+				index_offsets[k] = offset;
+				offset += index_counts[k];
+			}
+			for (int i=0, len=buffer.size(); i<len; ++i)
+			{
+				index_sorted[index_offsets[index_random[buffer[i]]]++] = buffer[i];
+			}
+			
+			//The offsets were used as cursors, so they now point at the end of each key's positions
+			for (int k=key_first; k<key_last; ++k)
+			{
+				index_offsets[k] -= index_counts[k];
+			}
+		}
+		
+		void run_chunks(vector<IndexChunk>& chunks, vector<pthread_t>& workers)
+		{
+			for (int t=0, len=chunks.size(); t<len; ++t)
+			{
+				pthread_create(&(workers[t]), NULL, thread_exec_chunk, &(chunks[t]));
+			}
+			for (int t=0, len=chunks.size(); t<len; ++t)
+			{
+				pthread_join(workers[t], NULL);
+			}
+		}
 		
+		//Counting sort of the positions by key
+		void sort_positions(int max)
+		{
 			//Temporary store used when sorting index
 			vector<int> index_temp;
 			index_temp.resize(max,0);
 			
-			//Populate randomly ordered index
-			DNA::seq2indices(sequence, index_random, seed, bisulfite);
-			
 			//Populate counts
 			for (int i=0; i<length; ++i)
 			{
@@ -107,48 +364,160 @@ namespace ReadSlam
 			}
 		}
 		
-		void build_index_map(int seed, bool bisulfite)
+		//Replace the sorted positions and their offsets with the Elias-Fano coded positions. The counts are kept
+		void compress()
+		{
+			index_compressed.build(index_sorted.empty() ? NULL : &(index_sorted[0]), &(index_counts[0]), index_counts.size(), length);
+			
+			vector<int>().swap(index_sorted);
+			vector<int>().swap(index_offsets);
+			attach();
+		}
+		
+		//The positions of a key in the vector index (ascending). Compressed positions are decoded into the buffer
+		inline int positions(int key, const int*& hits, vector<int>& buffer)
+		{
+			int count = counts[key];
+			
+			if (sorted != NULL)
+			{
+				hits = sorted + offsets[key];
+				return count;
+			}
+			if ((int)buffer.size() < count) buffer.resize(count);
+			if (count > 0) index_compressed.decode(counts, key, &(buffer[0]));
+			
+			hits = buffer.empty() ? NULL : &(buffer[0]);
+			return count;
+		}
+		
+		//Point the search tables at the index vectors
+		void attach()
+		{
+			sorted  = index_sorted.empty()  ? NULL : &(index_sorted[0]);
+			counts  = index_counts.empty()  ? NULL : &(index_counts[0]);
+			offsets = index_offsets.empty() ? NULL : &(index_offsets[0]);
+			keys    = index_counts.size();
+		}
+		
+		//Point the search tables at externally owned memory (eg. a mapped index file)
+		void attach(const int* sorted, const int* counts, const int* offsets, long keys, bool bisulfite)
 		{
+			this->sorted    = sorted;
+			this->counts    = counts;
+			this->offsets   = offsets;
+			this->keys      = keys;
 			this->bisulfite = bisulfite;
+		}
+		
+		//Free the index vectors (the search tables are detached)
+		void release()
+		{
+			vector<int>().swap(index_random);
+			vector<int>().swap(index_sorted);
+			vector<int>().swap(index_counts);
+			vector<int>().swap(index_offsets);
+			index_compressed.clear();
+			detach();
+		}
+		
+		void detach()
+		{
+			sorted  = NULL;
+			counts  = NULL;
+			offsets = NULL;
+			keys    = 0;
+		}
+		
+		//Build the compact hash index (a table of distinct k-mers over one contiguous position array)
+		void build_index_map(int seed, bool bisulfite, bool ry = false)
+		{
+			this->bisulfite = bisulfite;
+			this->ry = ry;
 			
-			//Populate randomly ordered index
-			vector<int> vals;
-			DNA::seq2indices(sequence, vals, seed, bisulfite);
+			vector<DNA::Kmer> keys;
+			build_keys(seed, bisulfite, keys);
+			index_hash.build(keys);
+		}
+		
+		//Build the sparse index (sorted distinct k-mers, for seeds past the dense table limit)
+		void build_index_sparse(int seed, bool bisulfite, bool ry = false)
+		{
+			this->bisulfite = bisulfite;
+			this->ry = ry;
 			
-			//Populate index
-			for (int i=0, len=vals.size(); i<len; ++i)
+			vector<DNA::Kmer> keys;
+			build_keys(seed, bisulfite, keys);
+			index_sparse.build(keys);
+		}
+		
+		//Bytes used by the vector index
+		long memory_index()
+		{
+			return (index_sorted.capacity() + index_counts.capacity() + index_offsets.capacity()) * sizeof(int) + index_compressed.memory();
+		}
+		
+		//Bytes used by whichever key index was built
+		long memory_keys()
+		{
+			return index_hash.memory() + index_sparse.memory();
+		}
+		
+		//Find the positions for a key in the sparse or hash index. Returns the number of positions
+		int lookup(DNA::Kmer key, const int*& hits)
+		{
+			if (!index_sparse.empty())
 			{
-				if (i%100000 == 0)
+				return index_sparse.lookup(key, hits);
+			}
+			return index_hash.lookup(key, hits);
+		}
+		
+		//Add the k-mers that occur more than threshold times on this strand to a repeat mask. Returns how many were added
+		long mask_repeats(RepeatMask& mask, int threshold)
+		{
+			long added = 0;
+			
+			for (long k=0; counts != NULL && k<keys; ++k)
+			{
+				if (counts[k] > threshold)
 				{
-					cout << (forward ? "+" : "-") << i <<  "            \r" << flush;
+					mask.add(k);
+					added++;
 				}
-				int val = vals[i];
-				
-				if (val == -1) continue;
-				
-				index_iterator = index_map.find(val);
+			}
+			for (size_t i=0, len=index_hash.slots.size(); i<len; ++i)
+			{
+				const IndexHash::Slot& slot = index_hash.slots[i];
 				
-				if (index_iterator == index_map.end())
+				if (slot.key != IndexHash::EMPTY && slot.count > threshold)
 				{
-					list<int> v;
-					index_map[val] = v;
+					mask.add(slot.key);
+					added++;
 				}
-				index_map[val].push_back(i);
 			}
-			vals.clear();
+			for (size_t i=0, len=index_sparse.keys.size(); i<len; ++i)
+			{
+				if (index_sparse.offsets[i+1] - index_sparse.offsets[i] > threshold)
+				{
+					mask.add(index_sparse.keys[i]);
+					added++;
+				}
+			}
+			return added;
 		}
 		
-		list<int>* lookup(int index)
+		//Populate randomly ordered keys for this strand
+		private: void build_keys(int seed, bool bisulfite, vector<DNA::Kmer>& keys)
 		{
-			if (index == -1) return NULL;
-
-			index_iterator = index_map.find(index);
-			
-			if (index_iterator == index_map.end())
 			{
-				return NULL;
+				string sequence;
+				reference->unpack(sequence, forward);
+				
+				if (ry) DNA::seq2keys_ry(sequence, keys, seed);
+				else DNA::seq2keys(sequence, keys, seed, bisulfite);
 			}
-			return &(index_iterator->second);
+			cout << (forward ? "+" : "-") << "            \r" << flush;
 		}
 	};
 }
@@ -20,15 +20,40 @@ void help_quick()
 	<< "\nCommands:"
 	<< "\n    HELP"
 	<< "\n    TRIM in.fastq out.fastq"
-	<< "\n    MAP genome.fasta in.fastq out.reads seedsize"
-	<< "\n    MAPBS genome.fasta in.fastq out.reads seedsize"
-	<< "\n    LIST_MAP genome.fasta in.fastq out.reads seedsize"
-	<< "\n    LIST_MAPBS genome.fasta in.fastq out.reads seedsize"
+	<< "\n    MAP genome.fasta in.fastq out.reads seedsize [options]"
+	<< "\n    MAPBS genome.fasta in.fastq out.reads seedsize [options]"
+	<< "\n    LIST_MAP genome.fasta in.fastq out.reads seedsize [options]"
+	<< "\n    LIST_MAPBS genome.fasta in.fastq out.reads seedsize [options]"
+	<< "\n    MINIMIZER_STATS genome.fasta in.fastq out.reads seedsize window"
+	<< "\n    MINIMIZER_STATSBS genome.fasta in.fastq out.reads seedsize window"
+	<< "\n    BWT_MAP genome.fasta in.fastq out.reads mismatches [--unique]"
+	<< "\n    BWT_MAPBS genome.fasta in.fastq out.reads mismatches [--unique]"
+	<< "\n    BWT_INDEX genome.fasta out.prefix"
+	<< "\n    BWT_INDEXBS genome.fasta out.prefix"
+	<< "\n    BWT_MAP_INDEX genome.fasta index.prefix in.fastq out.reads mismatches [--unique]"
+	<< "\n    INDEX genome.fasta out.index seedsize"
+	<< "\n    INDEXBS genome.fasta out.index seedsize"
+	<< "\n    MAP_INDEX genome.fasta genome.index in.fastq out.reads [options]"
+	<< "\n    SHARED_MAP genome.fasta name in.fastq out.reads seedsize [options]"
+	<< "\n    SHARED_MAPBS genome.fasta name in.fastq out.reads seedsize [options]"
+	<< "\n    SHARED_RELEASE name [force]"
 	<< "\n    STACK genome.fasta in.reads out.stacks"
 	<< "\n    CALL genome.fasta in.reads out.calls"
 	<< "\n    PARSE type infile outfile"
 	<< "\n    SORT type chunksize infile outfile"
 	<< "\n"
+	<< "\nMapping options:"
+	<< "\n    --strand          index the forward strands only"
+	<< "\n    --genome          one index over all of the assemblies"
+	<< "\n    --compressed      compress the index positions"
+	<< "\n    --window n        index only the minimizer of each window of n seeds"
+	<< "\n    --pigeonhole n    search disjoint seeds, finding every read with up to n mismatches"
+	<< "\n    --unique          stop searching a read at its second exact hit"
+	<< "\n    --repeats n       try seeds with more than n copies last (faster, may miss alignments)"
+	<< "\n    --batch n         map reads in batches of n (0 maps them one at a time, default 16384)"
+	<< "\n    --no-exact        skip the exact match pass before the seed search"
+	<< "\n    --cache n         reuse the results of duplicate reads from 2^n slots (0 turns this off, default 18)"
+	<< "\n"
 	<< endl;
 	exit(0);
 }
@@ -46,6 +71,19 @@ void help_full()
 	<<"\n  - MAPBS      : align reads to a reference genome (NaBS treated DNA)"
 	<<"\n  - LIST_MAP   : same as MAP with a different indexing system"
 	<<"\n  - LIST_MAPBS : same as MAPBS with a different indexing system"
+	<<"\n  - MINIMIZER_STATS : MINIMIZER_MAP, also mapping with the full index and reporting how the two compare"
+	<<"\n  - MINIMIZER_STATSBS : MINIMIZER_MAPBS, also mapping with the full index and reporting how the two compare"
+	<<"\n  - BWT_MAP    : align reads allowing a number of mismatches, using an FM-index (normal DNA)"
+	<<"\n  - BWT_MAPBS  : align reads allowing a number of mismatches, using an FM-index (NaBS treated DNA)"
+	<<"\n  - BWT_INDEX  : build the FM-indices once and save them to disk (normal DNA)"
+	<<"\n  - BWT_INDEXBS : build the FM-indices once and save them to disk (NaBS treated DNA)"
+	<<"\n  - BWT_MAP_INDEX : same as BWT_MAP using saved FM-indices (bisulfite mode comes from the index)"
+	<<"\n  - INDEX      : build a <vector> index once and save it to disk (normal DNA)"
+	<<"\n  - INDEXBS    : build a <vector> index once and save it to disk (NaBS treated DNA)"
+	<<"\n  - MAP_INDEX  : align reads using a saved index (seed and bisulfite mode come from the index)"
+	<<"\n  - SHARED_MAP : same as MAP using an index in shared memory (built by the first process)"
+	<<"\n  - SHARED_MAPBS : same as MAPBS using an index in shared memory (built by the first process)"
+	<<"\n  - SHARED_RELEASE : free a shared memory index"
 	<<"\n  - STACK      : stack aligned reads against a reference genome"
 	<<"\n  - CALL       : identify methylation sites"
 	<<"\n  - PARSE      : convert between filetypes"
@@ -53,6 +91,28 @@ void help_full()
 	<<"\n"
 	<<"\n--------------------------------------------------------------------------------"
 	<<"\n"
+	<<"\n:: Mapping Options ::"
+	<<"\nGiven after the parameters of MAP, MAPBS, LIST_MAP and LIST_MAPBS, and (except those that change the index)"
+	<<"\nof MAP_INDEX, SHARED_MAP and SHARED_MAPBS. Options can be combined."
+	<<"\n"
+	<<"\n  --strand       : index only the forward strands (half the index memory). Bisulfite seeds are in purines/pyrimidines"
+	<<"\n                   (one bit per seed base), so use about twice the seed size"
+	<<"\n  --genome       : one index over all of the assemblies (for references with many contigs)"
+	<<"\n  --compressed   : compress the index positions (under half the index memory, so larger seeds fit)"
+	<<"\n  --window n     : index only the minimizer of each window of n seeds (about 2 positions in n + 1)"
+	<<"\n  --pigeonhole n : search disjoint seeds, so reads with up to n mismatches are always found"
+	<<"\n  --unique       : stop searching a read at its second exact hit, as it cannot be unique (only unique reads are"
+	<<"\n                   wanted). Reads that are unique are mapped exactly as without it"
+	<<"\n  --repeats n    : try seeds that occur more than n times on a strand only after the others. Bounds the time"
+	<<"\n                   spent on repetitive reads, but a read may miss its best alignment (off by default)"
+	<<"\n  --batch n      : map reads in batches of n, looking up the seeds of a batch in index order (default 16384)."
+	<<"\n                   0 maps the reads one at a time. The results are the same either way"
+	<<"\n  --no-exact     : do not look each read up for exact matches before the seed search. The results are the same"
+	<<"\n  --cache n      : reuse the result of a recently mapped identical read, from a cache of 2^n slots (default 18)."
+	<<"\n                   0 turns the cache off. The results are the same either way"
+	<<"\n"
+	<<"\n--------------------------------------------------------------------------------"
+	<<"\n"
 	<<"\n:: Examples ::"
 	<<"\nNote: command keywords are case sensitive"
 	<<"\n"
@@ -71,6 +131,33 @@ void help_full()
 	<<"\n    ./readslam LIST_MAP ./human.fasta ./trimmed.fastq ./reads 12"
 	<<"\n    ./readslam LIST_MAPBS ./human.fasta ./trimmed.fastq ./reads 12"
 	<<"\n"
+	<<"\n- Map reads using a forward strand only index (bisulfite seeds are in purines/pyrimidines, so use about twice the seed size)"
+	<<"\n    ./readslam MAP ./human.fasta ./trimmed.fastq ./reads 13 --strand"
+	<<"\n    ./readslam MAPBS ./human.fasta ./trimmed.fastq ./reads 26 --strand"
+	<<"\n"
+	<<"\n- Map reads searching disjoint seeds (reads with up to 3 mismatches are found if they are at least 4 seeds long)"
+	<<"\n    ./readslam MAPBS ./human.fasta ./trimmed.fastq ./reads 12 --pigeonhole 3"
+	<<"\n"
+	<<"\n- Map reads against a genome of many contigs with a compressed index, keeping only the unique reads"
+	<<"\n    ./readslam MAPBS ./contigs.fasta ./trimmed.fastq ./reads 14 --genome --unique"
+	<<"\n    ./readslam MAPBS ./human.fasta ./trimmed.fastq ./reads 15 --compressed --unique"
+	<<"\n"
+	<<"\n- Map reads with up to 2 mismatches using an FM-index (no seed, memory does not depend on it)"
+	<<"\n    ./readslam BWT_MAPBS ./human.fasta ./trimmed.fastq ./reads 2"
+	<<"\n"
+	<<"\n- Build the FM-indices once (one file per assembly, named prefix.0, prefix.1, ...), then map against them"
+	<<"\n    ./readslam BWT_INDEXBS ./human.fasta ./human.bwt"
+	<<"\n    ./readslam BWT_MAP_INDEX ./human.fasta ./human.bwt ./trimmed.fastq ./reads 2"
+	<<"\n"
+	<<"\n- Build an index once, then map against it (the index file is memory mapped)"
+	<<"\n    ./readslam INDEXBS ./human.fasta ./human.index 14"
+	<<"\n    ./readslam MAP_INDEX ./human.fasta ./human.index ./trimmed.fastq ./reads"
+	<<"\n"
+	<<"\n- Map several lanes at once against one copy of the index, then free it"
+	<<"\n    ./readslam SHARED_MAPBS ./human.fasta human14 ./lane1.fastq ./lane1.reads 14 &"
+	<<"\n    ./readslam SHARED_MAPBS ./human.fasta human14 ./lane2.fastq ./lane2.reads 14 &"
+	<<"\n    ./readslam SHARED_RELEASE human14"
+	<<"\n"
 	<<"\n- Stack reads against a reference genome"
 	<<"\n    ./readslam STACK ./human.fasta ./reads ./stacks"
 	<<"\n"
@@ -127,6 +214,27 @@ int main (int argc, char* const argv[])
 	
 	ReadSlam::CLI handler;
 	
+	//Options (starting with --) follow the parameters of the mapping commands
+	vector<string> options;
+	
+	for (int i=2; i<argc; i++)
+	{
+		if (args[i].compare(0, 2, "--") != 0) continue;
+		
+		options.assign(args.begin() + i, args.end());
+		argc = i;
+		break;
+	}
+	
+	string mapping[] = { "MAP", "MAPBS", "LIST_MAP", "LIST_MAPBS", "BWT_MAP", "BWT_MAPBS", "BWT_MAP_INDEX", "MAP_INDEX", "SHARED_MAP", "SHARED_MAPBS" };
+	
+	string* last = mapping + sizeof(mapping) / sizeof(string);
+	
+	if (!options.empty() && find(mapping, last, args[1]) == last)
+	{
+		bomb("Options are only taken by the mapping commands (" + args[1] + " was given " + options[0] + ")");
+	}
+	
 	if (args[1] == "TRIM")
 	{
 		if (argc != 4) bomb("Incorrect parameter count for TRIM");
@@ -134,24 +242,89 @@ int main (int argc, char* const argv[])
 	}
 	else if (args[1] == "MAP")
 	{
-		if (argc != 6) bomb("Incorrect parameter count for MAP");
-		handler.map(args[2], args[3], args[4], atoi(args[5].c_str()), false, false);
+		if (argc < 6) bomb("Incorrect parameter count for MAP");
+		handler.map(args[2], args[3], args[4], atoi(args[5].c_str()), false, false, options);
 	}
 	else if (args[1] == "MAPBS")
 	{
-		if (argc != 6) bomb("Incorrect parameter count for MAP");
-		handler.map(args[2], args[3], args[4], atoi(args[5].c_str()), true, false);
+		if (argc < 6) bomb("Incorrect parameter count for MAPBS");
+		handler.map(args[2], args[3], args[4], atoi(args[5].c_str()), true, false, options);
 	}
 	else if (args[1] == "LIST_MAP")
 	{
-		if (argc != 6) bomb("Incorrect parameter count for MAP");
-		handler.map(args[2], args[3], args[4], atoi(args[5].c_str()), false, true);
+		if (argc < 6) bomb("Incorrect parameter count for LIST_MAP");
+		handler.map(args[2], args[3], args[4], atoi(args[5].c_str()), false, true, options);
 	}
 	else if (args[1] == "LIST_MAPBS")
 	{
-		if (argc != 6) bomb("Incorrect parameter count for MAP");
-		handler.map(args[2], args[3], args[4], atoi(args[5].c_str()), true, true);
-	}	
+		if (argc < 6) bomb("Incorrect parameter count for LIST_MAPBS");
+		handler.map(args[2], args[3], args[4], atoi(args[5].c_str()), true, true, options);
+	}
+	else if (args[1] == "MINIMIZER_STATS")
+	{
+		if (argc != 7) bomb("Incorrect parameter count for MINIMIZER_STATS");
+		handler.map_sampled_stats(args[2], args[3], args[4], atoi(args[5].c_str()), false, atoi(args[6].c_str()));
+	}
+	else if (args[1] == "MINIMIZER_STATSBS")
+	{
+		if (argc != 7) bomb("Incorrect parameter count for MINIMIZER_STATSBS");
+		handler.map_sampled_stats(args[2], args[3], args[4], atoi(args[5].c_str()), true, atoi(args[6].c_str()));
+	}
+	else if (args[1] == "BWT_MAP")
+	{
+		if (argc < 6) bomb("Incorrect parameter count for BWT_MAP");
+		handler.map_bwt(args[2], args[3], args[4], atoi(args[5].c_str()), false, options);
+	}
+	else if (args[1] == "BWT_MAPBS")
+	{
+		if (argc < 6) bomb("Incorrect parameter count for BWT_MAPBS");
+		handler.map_bwt(args[2], args[3], args[4], atoi(args[5].c_str()), true, options);
+	}
+	else if (args[1] == "BWT_INDEX")
+	{
+		if (argc != 4) bomb("Incorrect parameter count for BWT_INDEX");
+		handler.index_bwt(args[2], args[3], false);
+	}
+	else if (args[1] == "BWT_INDEXBS")
+	{
+		if (argc != 4) bomb("Incorrect parameter count for BWT_INDEXBS");
+		handler.index_bwt(args[2], args[3], true);
+	}
+	else if (args[1] == "BWT_MAP_INDEX")
+	{
+		if (argc < 7) bomb("Incorrect parameter count for BWT_MAP_INDEX");
+		handler.map_bwt_index(args[2], args[3], args[4], args[5], atoi(args[6].c_str()), options);
+	}
+	else if (args[1] == "INDEX")
+	{
+		if (argc != 5) bomb("Incorrect parameter count for INDEX");
+		handler.index(args[2], args[3], atoi(args[4].c_str()), false);
+	}
+	else if (args[1] == "INDEXBS")
+	{
+		if (argc != 5) bomb("Incorrect parameter count for INDEXBS");
+		handler.index(args[2], args[3], atoi(args[4].c_str()), true);
+	}
+	else if (args[1] == "MAP_INDEX")
+	{
+		if (argc < 6) bomb("Incorrect parameter count for MAP_INDEX");
+		handler.map_index(args[2], args[3], args[4], args[5], options);
+	}
+	else if (args[1] == "SHARED_MAP")
+	{
+		if (argc < 7) bomb("Incorrect parameter count for SHARED_MAP");
+		handler.map_shared(args[2], args[3], args[4], args[5], atoi(args[6].c_str()), false, options);
+	}
+	else if (args[1] == "SHARED_MAPBS")
+	{
+		if (argc < 7) bomb("Incorrect parameter count for SHARED_MAPBS");
+		handler.map_shared(args[2], args[3], args[4], args[5], atoi(args[6].c_str()), true, options);
+	}
+	else if (args[1] == "SHARED_RELEASE")
+	{
+		if (argc != 3 && argc != 4) bomb("Incorrect parameter count for SHARED_RELEASE");
+		handler.release_shared(args[2], argc == 4 && args[3] == "force");
+	}
 	else if (args[1] == "STACK")
 	{
 		if (argc != 5) bomb("Incorrect parameter count for STACK");
@@ -174,7 +347,7 @@ int main (int argc, char* const argv[])
 	}
 	else
 	{
-		bomb("Unknown command. Legal values are HELP | TRIM | MAP | MAPBS | STACK | METH | PARSE | SORT");
+		bomb("Unknown command. Legal values are HELP | TRIM | MAP | MAPBS | LIST_MAP | LIST_MAPBS | MINIMIZER_STATS | MINIMIZER_STATSBS | BWT_MAP | BWT_MAPBS | BWT_INDEX | BWT_INDEXBS | BWT_MAP_INDEX | INDEX | INDEXBS | MAP_INDEX | SHARED_MAP | SHARED_MAPBS | SHARED_RELEASE | STACK | METH | PARSE | SORT");
 	}
 	return 0;
 }
@@ -0,0 +1,984 @@
+#include "../core/_genome.h"
+#include "../tools/_mapper_bwt.h"
+
+//Regression tests for the mapper. A small random genome and reads taken from it are written to the working
+//directory, mapped in the different modes, and the results compared. Returns the number of failed tests
+int failures = 0;
+
+void check(bool passed, string test)
+{
+	cout << (passed ? "PASS: " : "FAIL: ") << test << endl;
+	if (!passed) failures++;
+}
+
+string random_dna(int length)
+{
+	static const char bases[] = "ACGT";
+	string dna (length, 'A');
+
+	for (int i=0; i<length; ++i)
+	{
+		dna[i] = bases[rand() % 4];
+	}
+	return dna;
+}
+
+void write_genome(string outfile, vector<string>& assemblies)
+{
+	ofstream out (outfile.c_str());
+
+	for (int i=0; i<3; ++i)
+	{
+		assemblies.push_back(random_dna(100000 + 50000 * i));
+		out << ">chr" << (i + 1) << endl;
+
+		for (size_t j=0; j<assemblies[i].size(); j+=60)
+		{
+			out << assemblies[i].substr(j, 60) << endl;
+		}
+	}
+	out.close();
+}
+
+//Unmapped reads carry the highest score an alignment may have
+void write_read(ofstream& out, string name, string sequence)
+{
+	out << "0\t0\t" << (255 * sequence.size()) << "\t.\t+\t0\t" << name << "\t1\t" << sequence << "\t" << string(sequence.size(), 'I') << endl;
+}
+
+//Reads from either strand of the genome with up to 3 mismatches
+void write_reads(string outfile, vector<string>& assemblies, int count)
+{
+	ofstream out (outfile.c_str());
+
+	for (int r=0; r<count; ++r)
+	{
+		string& a = assemblies[rand() % assemblies.size()];
+		int length = 36 + rand() % 40;
+		string read = a.substr(rand() % (a.size() - length), length);
+
+		for (int m=rand() % 4; m>0; --m)
+		{
+			read[rand() % length] = "ACGT"[rand() % 4];
+		}
+		if (rand() % 2) read = DNA::reverse_complement(read);
+
+		write_read(out, Strings::add_int("r", r), read);
+	}
+	out.close();
+}
+
+bool same_file(string a, string b)
+{
+	ifstream in_a (a.c_str());
+	ifstream in_b (b.c_str());
+	string line_a, line_b;
+
+	while (getline(in_a, line_a))
+	{
+		if (!getline(in_b, line_b) || line_a != line_b) return false;
+	}
+	return !getline(in_b, line_b);
+}
+
+//The same hits, except that of a read's equally good locations either search may report a different one
+bool same_hits(string a, string b)
+{
+	ifstream in_a (a.c_str());
+	ifstream in_b (b.c_str());
+	string line_a, line_b;
+
+	while (getline(in_a, line_a))
+	{
+		if (!getline(in_b, line_b)) return false;
+
+		vector<string> fa = Strings::tabsplit(line_a);
+		vector<string> fb = Strings::tabsplit(line_b);
+
+		if (fa.size() != fb.size()) return false;
+
+		for (size_t i=0; i<fa.size(); ++i)
+		{
+			if (fa[i] != fb[i] && !(fa[0] != "1" && i >= 3 && i <= 5)) return false;
+		}
+	}
+	return !getline(in_b, line_b);
+}
+
+//The threaded pipeline maps every read the same way as a single thread, batched or not
+void test_threaded(string genome, string reads)
+{
+	for (int batch=0; batch<2; ++batch)
+	{
+		ReadSlam::Genome g;
+		g.load(genome);
+		g.batch_size = batch ? 1000 : 0;
+		g.build_index(10, false, false);
+
+		g.map_reads(reads, "test_single.slam", true);
+		long candidates = g.mapped_candidates;
+
+		g.system.cpus = 4;
+		g.map_threaded(reads, "test_threaded.slam");
+
+		string mode = batch ? "batched" : "unbatched";
+		check(same_file("test_single.slam", "test_threaded.slam"), "threaded mapping matches a single thread (" + mode + ")");
+		check(g.mapped_candidates == candidates, "threaded mapping verifies the same candidates (" + mode + ")");
+	}
+}
+
+//Reads without a whole seed free of Ns (too short, all Ns, or an N every 9 bases) go through the exact match pass
+//and come out unmapped, in every mapping mode
+void test_no_tiles(string genome, vector<string>& assemblies)
+{
+	string read = assemblies[0].substr(1000, 45);
+
+	for (int i=8; i<45; i+=9)
+	{
+		read[i] = 'N';
+	}
+	ofstream out ("test_no_tiles.slam");
+	write_read(out, "short", assemblies[0].substr(500, 7));
+	write_read(out, "all_n", string(40, 'N'));
+	write_read(out, "n_every_9", read);
+	write_read(out, "exact", assemblies[1].substr(2000, 50));
+	out.close();
+
+	for (int mode=0; mode<3; ++mode)
+	{
+		ReadSlam::Genome g;
+		g.load(genome);
+		g.batch_size = mode == 1 ? 1000 : 0;
+		g.index_global = mode == 2;
+		g.build_index(10, false, false);
+		g.map_reads("test_no_tiles.slam", "test_no_tiles_out.slam", true);
+
+		string name = mode == 0 ? "unbatched" : (mode == 1 ? "batched" : "genome-wide");
+		check(g.mapped_total == 4 && g.mapped_failed == 3 && g.mapped_exact == 1, "reads without tiles map without an exact hit (" + name + ")");
+	}
+}
+
+//Copies of a read reuse the first copy's result (from the cache, or from within a batch) without verifying any
+//candidates, so they add none to the candidate count
+void test_duplicates(string genome, vector<string>& assemblies)
+{
+	string read = assemblies[2].substr(3000, 50);
+	read[10] = read[10] == 'A' ? 'C' : 'A';
+
+	ofstream out ("test_duplicates.slam");
+
+	for (int i=0; i<1000; ++i)
+	{
+		write_read(out, Strings::add_int("copy", i), read);
+	}
+	out.close();
+
+	long candidates[2];
+
+	for (int batch=0; batch<2; ++batch)
+	{
+		ReadSlam::Genome g;
+		g.load(genome);
+		g.batch_size = batch ? 1000 : 0;
+		g.build_index(10, false, false);
+		g.map_reads("test_duplicates.slam", "test_duplicates_out.slam", true);
+
+		candidates[batch] = g.mapped_candidates;
+		check(g.mapped_cached == 999, batch ? "duplicates reuse the first copy (batched)" : "duplicates reuse the first copy (unbatched)");
+	}
+	check(candidates[0] == candidates[1] && candidates[0] < 1000, "duplicates are not counted as candidates");
+}
+
+//An index saved to disk and memory mapped back in maps every read the same way as the index it was saved from
+void test_saved_index(string genome, string reads)
+{
+	ReadSlam::Genome built;
+	built.load(genome);
+	built.build_index(10, false, false);
+	built.save_index("test_genome.index");
+	built.map_reads(reads, "test_built.slam", true);
+
+	ReadSlam::Genome loaded;
+	loaded.load(genome);
+	loaded.load_index("test_genome.index");
+	loaded.map_reads(reads, "test_loaded.slam", true);
+
+	check(loaded.index_seed == 10 && !loaded.bisulfite, "a saved index keeps its seed and mode");
+	check(same_file("test_built.slam", "test_loaded.slam"), "a saved index maps the same as the index it was saved from");
+}
+
+//A shared index is built by the first process to ask for it and attached to by the others. It maps like a private
+//index, can be opened by other users, and can only be removed once nobody is attached to it
+void test_shared_index(string genome, string reads)
+{
+	string name = Strings::add_int("test_mapper.", getpid());
+
+	ReadSlam::Genome plain;
+	plain.load(genome);
+	plain.build_index(10, false, false);
+	plain.map_reads(reads, "test_plain.slam", true);
+
+	ReadSlam::Genome first;
+	first.load(genome);
+	first.share_index(name, 10, false);
+	check(ReadSlam::SharedMemory::users(name) == 1, "the process that builds a shared index is attached to it");
+
+	ReadSlam::Genome second;
+	second.load(genome);
+	second.share_index(name, 10, false);
+	second.map_reads(reads, "test_shared.slam", true);
+	check(ReadSlam::SharedMemory::users(name) == 2, "a second process attaches to a shared index");
+	check(same_file("test_plain.slam", "test_shared.slam"), "a shared index maps the same as a private one");
+
+	struct stat info;
+	int fd = shm_open(ReadSlam::SharedMemory::segment(name).c_str(), O_RDONLY, 0);
+	check(fd != -1 && fstat(fd, &info) == 0 && (info.st_mode & 0666) == 0666, "a shared index can be attached to by other users");
+	if (fd != -1) close(fd);
+
+	check(!ReadSlam::SharedMemory::remove(name, false), "a shared index in use is not removed");
+	first.clear();
+	second.clear();
+	check(ReadSlam::SharedMemory::users(name) == 0, "detached processes release their slots");
+	check(ReadSlam::SharedMemory::remove(name, false) && ReadSlam::SharedMemory::users(name) == -1, "an unused shared index is removed");
+}
+
+//Positions of every occurrence of a pattern, found by scanning the text
+vector<long> occurrences(const string& text, const string& pattern)
+{
+	vector<long> found;
+
+	for (size_t p=text.find(pattern); p!=string::npos; p=text.find(pattern, p + 1))
+	{
+		found.push_back(p);
+	}
+	return found;
+}
+
+//The FM-index counts and locates every occurrence of a pattern (patterns from the text, with repeats, and random ones)
+void test_fm_index()
+{
+	string text = random_dna(20000);
+	text += text.substr(5000, 3000);
+
+	FMIndex fm;
+	fm.build(text, 8);
+
+	bool counted = true;
+	bool located = true;
+
+	for (int t=0; t<1000; ++t)
+	{
+		int length = 1 + rand() % 14;
+		string pattern = t % 2 ? random_dna(length) : text.substr(rand() % (text.size() - length), length);
+		vector<long> expected = occurrences(text, pattern);
+
+		FMIndex::Range rows = fm.find(pattern);
+		vector<long> found;
+
+		for (long r=rows.lo; r<rows.hi; ++r)
+		{
+			found.push_back(fm.locate(r));
+		}
+		sort(found.begin(), found.end());
+
+		counted = counted && fm.count(pattern) == (long)expected.size();
+		located = located && found == expected;
+	}
+	check(counted, "the FM-index counts every occurrence of a pattern");
+	check(located, "the FM-index locates every occurrence of a pattern");
+}
+
+//FM-indices saved to disk and loaded back in map every read the same way as the indices they were saved from
+void test_saved_bwt(string genome, string reads)
+{
+	ReadSlam::MapperBWT built;
+	built.load(genome);
+	built.build(true, 2);
+	built.save_index("test_genome.bwt");
+	built.map(reads, "test_bwt_built.slam");
+
+	ReadSlam::MapperBWT loaded;
+	loaded.load(genome);
+	loaded.load_index("test_genome.bwt", 2);
+	loaded.map(reads, "test_bwt_loaded.slam");
+
+	check(loaded.indices[0]->bisulfite, "saved FM-indices keep their bisulfite mode");
+	check(same_file("test_bwt_built.slam", "test_bwt_loaded.slam"), "saved FM-indices map the same as the indices they were saved from");
+}
+
+//The BWT mapper finds every read with up to its number of mismatches, and never reports an alignment with more
+void test_bwt_mismatches(string genome, vector<string>& assemblies)
+{
+	ofstream out ("test_bwt_reads.slam");
+	vector<int> planted;
+
+	for (int r=0; r<600; ++r)
+	{
+		string& a = assemblies[rand() % assemblies.size()];
+		int length = 36 + rand() % 40;
+		string read = a.substr(rand() % (a.size() - length), length);
+		string original = read;
+
+		planted.push_back(r % 4);
+
+		for (int m=0; m<planted[r]; )
+		{
+			int i = rand() % length;
+			char base = "ACGT"[rand() % 4];
+
+			if (read[i] != original[i] || base == read[i]) continue;
+
+			read[i] = base;
+			m++;
+		}
+		if (rand() % 2) read = DNA::reverse_complement(read);
+
+		write_read(out, Strings::add_int("r", r), read);
+	}
+	out.close();
+
+	ReadSlam::MapperBWT m;
+	m.load(genome);
+	m.build(false, 2);
+	m.map("test_bwt_reads.slam", "test_bwt_mapped.slam");
+
+	ifstream in ("test_bwt_mapped.slam");
+	ReadSlam::Read read;
+	bool found = true;
+	bool limited = true;
+
+	for (size_t r=0; r<planted.size() && read.load(in); ++r)
+	{
+		if (planted[r] <= 2) found = found && read.locations > 0 && read.mismatches <= planted[r];
+		if (read.locations > 0) limited = limited && read.mismatches <= 2;
+	}
+	check(found, "the BWT mapper finds every read with up to 2 mismatches");
+	check(limited, "the BWT mapper reports no alignment with more than 2 mismatches");
+}
+
+//Orders suffixes of a DNA text the way SuffixSort::sort_dna does (anything but A, C or G sorts as T)
+struct CompareSuffix
+{
+	string text;
+
+	bool operator() (SuffixSort::Index a, SuffixSort::Index b) const
+	{
+		return text.compare(a, string::npos, text, b, string::npos) < 0;
+	}
+};
+
+//SA-IS sorts the suffixes of a DNA text (with repeats and Ns) in the same order as comparing them
+void test_suffix_array()
+{
+	string text = random_dna(3000);
+	text += text.substr(100, 500) + "NNNN" + text.substr(100, 500);
+
+	vector<SuffixSort::Index> sa;
+	SuffixSort::sort_dna(text, sa, 1);
+
+	CompareSuffix compare;
+	compare.text = text;
+	replace(compare.text.begin(), compare.text.end(), 'N', 'T');
+
+	vector<SuffixSort::Index> expected;
+
+	for (size_t i=0; i<=text.size(); ++i)
+	{
+		expected.push_back(i);
+	}
+	sort(expected.begin(), expected.end(), compare);
+
+	check(sa == expected, "SA-IS sorts suffixes in the same order as comparing them");
+}
+
+//The parallel doubling sorter gives the same suffix array as SA-IS, and the FM-index built from it on several threads
+//is the same as one built on a single thread
+void test_parallel_sort()
+{
+	string text = random_dna(200000);
+	text += text.substr(1000, 20000) + "NNNN" + text.substr(1000, 20000);
+
+	vector<SuffixSort::Index> serial;
+	vector<SuffixSort::Index> parallel;
+	SuffixSort::sort_dna(text, serial, 1);
+	SuffixSort::sort_dna(text, parallel, SuffixSort::MIN_THREADS);
+
+	check(serial == parallel, "the parallel suffix sort matches SA-IS");
+
+	FMIndex one;
+	FMIndex many;
+	one.build(text, 16, 1);
+	many.build(text, 16, SuffixSort::MIN_THREADS);
+
+	bool same = one.primary == many.primary && one.samples == many.samples && one.blocks.size() == many.blocks.size();
+	same = same && memcmp(&(one.blocks[0]), &(many.blocks[0]), one.blocks.size() * sizeof(FMIndex::Block)) == 0;
+
+	check(same, "an FM-index built on several threads matches one built on a single thread");
+}
+
+//The hash index maps every read the same way as the vector index
+void test_hash_index(string genome, string reads)
+{
+	string files[2] = { "test_vector.slam", "test_hash.slam" };
+
+	for (int usemap=0; usemap<2; ++usemap)
+	{
+		ReadSlam::Genome g;
+		g.load(genome);
+		g.build_index(10, false, usemap);
+		g.map_reads(reads, files[usemap], true);
+	}
+	check(same_file(files[0], files[1]), "the hash index maps the same as the vector index");
+}
+
+//The sparse index (used when the vector tables do not fit) maps every read the same way as the vector index, and at
+//seeds past 16 bases (64-bit keys) the same way as the hash index
+void test_sparse_index(string genome, string reads)
+{
+	ReadSlam::Genome vector_index;
+	vector_index.load(genome);
+	vector_index.build_index(10, false, false);
+	vector_index.map_reads(reads, "test_vector.slam", true);
+
+	//Too little RAM for the seed 10 tables, but enough for the sparse index
+	ReadSlam::Genome small;
+	small.load(genome);
+	small.system.ram = 20;
+	small.build_index(10, false, false);
+	small.map_reads(reads, "test_sparse.slam", true);
+
+	check(small.index_sparse && small.index_seed == 10, "the sparse index is used when the vector tables do not fit");
+	check(same_file("test_vector.slam", "test_sparse.slam"), "the sparse index maps the same as the vector index");
+
+	string files[2] = { "test_sparse_20.slam", "test_hash_20.slam" };
+
+	for (int usemap=0; usemap<2; ++usemap)
+	{
+		ReadSlam::Genome g;
+		g.load(genome);
+		g.build_index(20, false, usemap);
+		g.map_reads(reads, files[usemap], true);
+
+		if (!usemap) check(g.index_sparse && g.index_seed == 20, "seeds too large for the vector index use the sparse index");
+	}
+	check(same_file(files[0], files[1]), "the sparse index maps the same as the hash index with 64-bit keys");
+}
+
+//A forward strand only index maps every read the same way as an index of both strands (vector and hash indices)
+void test_single_strand(string genome, string reads)
+{
+	for (int usemap=0; usemap<2; ++usemap)
+	{
+		string files[2] = { "test_both.slam", "test_forward.slam" };
+
+		for (int single=0; single<2; ++single)
+		{
+			ReadSlam::Genome g;
+			g.load(genome);
+			g.build_index(10, false, usemap, single);
+			g.map_reads(reads, files[single], true);
+		}
+		check(same_file(files[0], files[1]), usemap ? "a forward strand hash index maps the same as both strands" : "a forward strand vector index maps the same as both strands");
+	}
+}
+
+//Repeat masking is off by default, and building a mask that masks nothing leaves every result unchanged
+void test_repeat_mask(string genome, string reads)
+{
+	ReadSlam::Genome off;
+	off.load(genome);
+	off.build_index(8, false, false);
+	off.map_reads(reads, "test_unmasked.slam", true);
+
+	check(off.repeat_threshold == 0 && off.repeats.empty(), "repeat masking is off by default");
+
+	ReadSlam::Genome unused;
+	unused.load(genome);
+	unused.repeat_threshold = 1000000;
+	unused.build_index(8, false, false);
+	unused.map_reads(reads, "test_mask_unused.slam", true);
+
+	check(same_file("test_unmasked.slam", "test_mask_unused.slam"), "a repeat mask that masks nothing leaves the results unchanged");
+
+	ReadSlam::Genome masked;
+	masked.load(genome);
+	masked.repeat_threshold = 8;
+	masked.build_index(8, false, false);
+	masked.map_reads(reads, "test_masked.slam", true);
+
+	check(!masked.repeats.empty() && masked.mapped_candidates < off.mapped_candidates, "masking frequent seeds verifies fewer candidates");
+}
+
+//Reads whose first two hits tie at a mismatch are still searched, so a better hit found later makes them unique.
+//Unique only mode maps every read that is unique (or unmapped) in a full search the same way, with the seed index
+//and with the BWT mapper
+void test_unique_only(string genome, string reads)
+{
+	//Two copies of the read on chr1 with a mismatch at a high quality base, one on chr2 with a mismatch at a low one
+	string read = random_dna(60);
+	string copies[3] = { read, read, read };
+	copies[0][40] = copies[1][40] = read[40] == 'A' ? 'C' : 'A';
+	copies[2][20] = read[20] == 'A' ? 'C' : 'A';
+
+	ofstream fa ("test_ties.fa");
+	fa << ">chr1" << endl << random_dna(5000) << copies[0] << random_dna(5000) << copies[1] << random_dna(5000) << endl;
+	fa << ">chr2" << endl << random_dna(5000) << copies[2] << random_dna(5000) << endl;
+	fa.close();
+
+	string qualities (60, 'I');
+	qualities[20] = '#';
+
+	ofstream out ("test_ties.slam");
+	out << "0\t0\t" << (255 * 60) << "\t.\t+\t0\ttied\t1\t" << read << "\t" << qualities << endl;
+	out.close();
+
+	ReadSlam::Genome ties;
+	ties.load("test_ties.fa");
+	ties.unique_only = true;
+	ties.build_index(10, false, false);
+	ties.map_reads("test_ties.slam", "test_ties_out.slam", true);
+	check(ties.mapped_unique == 1, "a read is not settled by two tied hits that a later hit beats");
+
+	ReadSlam::MapperBWT bwt;
+	bwt.load("test_ties.fa");
+	bwt.unique_only = true;
+	bwt.build(false, 2);
+	bwt.map("test_ties.slam", "test_ties_out.slam");
+	check(bwt.stats.unique == 1, "a read is not settled by two tied hits that a later hit beats (BWT)");
+
+	string files[2] = { "test_all.slam", "test_unique.slam" };
+
+	for (int unique=0; unique<2; ++unique)
+	{
+		ReadSlam::Genome g;
+		g.load(genome);
+		g.unique_only = unique;
+		g.build_index(10, false, false);
+		g.map_reads(reads, files[unique], true);
+	}
+	ifstream all (files[0].c_str());
+	ifstream only (files[1].c_str());
+	string line_all, line_only;
+	bool same = true;
+
+	while (getline(all, line_all) && getline(only, line_only))
+	{
+		if (line_all[0] == '0' || line_all.compare(0, 2, "1\t") == 0 || line_only[0] == '0' || line_only.compare(0, 2, "1\t") == 0)
+		{
+			same = same && line_all == line_only;
+		}
+	}
+	check(same, "unique only mode maps the unique and unmapped reads the same as a full search");
+}
+
+//The mapping speedups that are on by default (batching, the exact match pass and the duplicate cache) leave every result unchanged when they are turned off
+void test_defaults(string genome, string reads)
+{
+	//The reads, the first 500 each followed by a copy
+	ifstream in (reads.c_str());
+	ofstream out ("test_defaults_reads.slam");
+	string line;
+
+	for (int r=0; getline(in, line); ++r)
+	{
+		out << line << endl;
+		if (r < 500) out << line << endl;
+	}
+	out.close();
+
+	string files[2] = { "test_defaults.slam", "test_plain_search.slam" };
+	long cached = 0;
+
+	for (int off=0; off<2; ++off)
+	{
+		ReadSlam::Genome g;
+		g.load(genome);
+
+		if (off)
+		{
+			g.batch_size = 0;
+			g.exact_first = false;
+			g.cache_bits = 0;
+		}
+		g.build_index(10, false, false);
+		g.map_reads("test_defaults_reads.slam", files[off], true);
+
+		if (!off) cached = g.mapped_cached;
+	}
+	check(same_file(files[0], files[1]), "turning off the default speedups leaves the results unchanged");
+	check(cached == 500, "the default run reuses the results of the duplicates");
+}
+
+//The key of the seed at a position, one base at a time (NO_KMER if it runs into anything but A, C, G or T, or off the end)
+DNA::Kmer naive_key(const string& seq, int pos, int seed, bool bs, bool ry)
+{
+	DNA::Kmer key = 0;
+
+	for (int j=0; j<seed; ++j)
+	{
+		if (pos + j >= (int)seq.size()) return DNA::NO_KMER;
+
+		int code;
+
+		switch (seq[pos + j])
+		{
+			case 'A' : code = 0; break;
+			case 'C' : code = bs ? 3 : 1; break;
+			case 'G' : code = 2; break;
+			case 'T' : code = 3; break;
+			default  : return DNA::NO_KMER;
+		}
+		key = ry ? (key << 1) | (code & 1) : (key << 2) | code;
+	}
+	return key;
+}
+
+//The block encoders (AVX2 where the CPU has it) give the same keys as encoding one base at a time, at every seed size,
+//with Ns, lowercase bases and any other bytes
+void test_kmer_keys()
+{
+	string seq = random_dna(10000);
+
+	for (int i=0; i<300; ++i)
+	{
+		seq[rand() % seq.size()] = "Nnacgt-"[rand() % 7];
+	}
+
+	bool encoded = true;
+
+	for (int length=0; length<200; ++length)
+	{
+		string bytes (length, 0);
+
+		for (int i=0; i<length; ++i)
+		{
+			bytes[i] = (char)(rand() % 256);
+		}
+		vector<unsigned char> scalar (length + 1);
+		vector<unsigned char> table (length + 1);
+
+		for (int bs=0; bs<2; ++bs)
+		{
+			DNA::encode_scalar(bytes.data(), length, &(scalar[0]), bs);
+			DNA::encode(bytes.data(), length, &(table[0]), bs);
+			encoded = encoded && scalar == table;
+		}
+	}
+	check(encoded, "the base encoder picked for this CPU matches the scalar one");
+
+	bool same = true;
+
+	for (int seed=1; seed<=DNA::MAX_KMER; ++seed)
+	{
+		vector<DNA::Kmer> keys;
+		vector<DNA::Kmer> bs_keys;
+		vector<DNA::Kmer> ry_keys;
+		vector<int> indices;
+
+		DNA::seq2keys(seq, keys, seed, false);
+		DNA::seq2keys(seq, bs_keys, seed, true);
+		DNA::seq2keys_ry(seq, ry_keys, seed);
+		if (seed <= 15) DNA::seq2indices(seq, indices, seed, false);
+
+		for (int i=0; i<(int)seq.size(); ++i)
+		{
+			DNA::Kmer key = naive_key(seq, i, seed, false, false);
+
+			same = same && keys[i] == key && bs_keys[i] == naive_key(seq, i, seed, true, false) && ry_keys[i] == naive_key(seq, i, seed, false, true);
+			if (seed <= 15) same = same && indices[i] == (key == DNA::NO_KMER ? -1 : (int)key);
+		}
+	}
+	check(same, "rolled k-mer keys match the keys built one base at a time");
+}
+
+//An index built on several threads is the same as one built on a single thread (with and without minimizer sampling,
+//and in the purine/pyrimidine alphabet)
+void test_threaded_index()
+{
+	//Only assemblies of at least Sequence::MIN_CHUNK bases are split between threads
+	string dna = random_dna(ReadSlam::Sequence::MIN_CHUNK + 200000);
+	dna.replace(500000, 1000, string(1000, 'N'));
+
+	ofstream out ("test_large.fa");
+	out << ">chr1" << endl << dna << endl;
+	out.close();
+
+	string genome = "test_large.fa";
+	int modes[4][3] = { { 10, 0, 0 }, { 10, 5, 0 }, { 20, 0, 1 }, { 20, 5, 1 } }; //Seed, window, bisulfite single strand
+	bool same = true;
+
+	for (int m=0; m<4; ++m)
+	{
+		ReadSlam::Genome g[2];
+
+		for (int t=0; t<2; ++t)
+		{
+			g[t].load(genome);
+			g[t].system.cpus = t ? 4 : 1;
+			g[t].index_window = modes[m][1];
+			g[t].build_index(modes[m][0], modes[m][2], false, modes[m][2]);
+		}
+		for (int i=0; i<g[0].num_assemblies; ++i)
+		{
+			ReadSlam::Sequence* s[2][2] = { { &(g[0].assemblies[i].forward), &(g[0].assemblies[i].reverse) }, { &(g[1].assemblies[i].forward), &(g[1].assemblies[i].reverse) } };
+
+			for (int j=0; j<2; ++j)
+			{
+				ReadSlam::Sequence& a = *(s[0][j]);
+				ReadSlam::Sequence& b = *(s[1][j]);
+				long keys = 1L << ((modes[m][2] ? 1 : 2) * g[0].index_seed);
+
+				same = same && a.indexed == b.indexed;
+				same = same && (a.indexed == 0 || memcmp(a.sorted, b.sorted, a.indexed * sizeof(int)) == 0);
+				same = same && (a.indexed == 0 || memcmp(a.counts, b.counts, keys * sizeof(int)) == 0);
+				same = same && (a.indexed == 0 || memcmp(a.offsets, b.offsets, keys * sizeof(int)) == 0);
+			}
+		}
+	}
+	check(same, "an index built on several threads matches one built on a single thread");
+}
+
+//The compressed index holds the same positions as the plain one, so it maps every read the same way, on both strands
+//or forward only, and batched on several threads
+void test_compressed(string genome, string reads)
+{
+	for (int single=0; single<2; ++single)
+	{
+		string files[2] = { "test_plain.slam", "test_compressed.slam" };
+		long candidates[2];
+
+		for (int compressed=0; compressed<2; ++compressed)
+		{
+			ReadSlam::Genome g;
+			g.load(genome);
+			g.index_compressed = compressed;
+			g.build_index(10, false, false, single);
+			g.map_reads(reads, files[compressed], true);
+			candidates[compressed] = g.mapped_candidates;
+
+			if (compressed)
+			{
+				g.batch_size = 1000;
+				g.system.cpus = 4;
+				g.map_threaded(reads, "test_compressed_threaded.slam");
+			}
+		}
+		string mode = single ? "forward strand only" : "both strands";
+		check(same_file(files[0], files[1]), "the compressed index maps the same as the plain index (" + mode + ")");
+		check(candidates[0] == candidates[1], "the compressed index verifies the same candidates (" + mode + ")");
+		check(same_file(files[0], "test_compressed_threaded.slam"), "the compressed index maps the same batched on several threads (" + mode + ")");
+	}
+}
+
+//Minimizer sampling keeps, in every window, the leftmost key lowest in minimizer_order, as found by scanning each
+//window in turn. Few distinct keys make ties, and missing keys (-1) are never kept
+void test_minimizers()
+{
+	bool same = true;
+	vector<int> queue;
+
+	for (int t=0; t<200 && same; ++t)
+	{
+		int count = 1 + rand() % 300;
+		int window = 1 + rand() % 12;
+		int distinct = t % 2 ? 8 : 1 << 20;
+		vector<int> keys (count);
+
+		for (int i=0; i<count; ++i)
+		{
+			keys[i] = rand() % 10 == 0 ? -1 : rand() % distinct;
+		}
+		vector<int> expected (count, -1);
+
+		for (int start=0; start + window <= count; ++start)
+		{
+			int best = -1;
+
+			for (int i=start; i<start + window; ++i)
+			{
+				if (keys[i] != -1 && (best == -1 || DNA::minimizer_order(keys[i]) < DNA::minimizer_order(keys[best]))) best = i;
+			}
+			if (best != -1) expected[best] = keys[best];
+		}
+		DNA::minimizers(&(keys[0]), count, window, queue);
+		same = keys == expected;
+	}
+	check(same, "minimizer sampling keeps the lowest key of every window");
+}
+
+//Whether every mapped read is reported with as many mismatches as it has against the genome where it is placed
+bool valid_hits(string file, ReadSlam::Genome& g)
+{
+	ifstream in (file.c_str());
+	string line;
+
+	while (getline(in, line))
+	{
+		vector<string> f = Strings::tabsplit(line);
+		if (f[0] == "0") continue;
+
+		string read = f[4] == "+" ? f[8] : DNA::reverse_complement(f[8]);
+		string reference (read.size(), 'N');
+		int a = 0;
+
+		while (a < g.num_assemblies && g.assemblies[a].name != f[3]) a++;
+		if (a == g.num_assemblies) return false;
+
+		g.assemblies[a].forward.window(atoi(f[5].c_str()), read.size(), &(reference[0]));
+		int mismatches = 0;
+
+		for (size_t i=0; i<read.size(); ++i)
+		{
+			mismatches += read[i] != reference[i];
+		}
+		if (mismatches != atoi(f[1].c_str())) return false;
+	}
+	return true;
+}
+
+//The minimizer-sampled index maps every read the same way unbatched, batched, on several threads and compressed. The
+//hits it reports are real, and a read found without mismatches by the full index is still found without mismatches
+//(it matches the genome over a whole window). Other reads may get a better or a worse hit, as each strand is only
+//searched from its first seed with any positions, and that seed differs
+void test_minimizer_index(string genome, string reads)
+{
+	ReadSlam::Genome full;
+	full.load(genome);
+	full.build_index(10, false, false);
+	full.map_reads(reads, "test_full.slam", true);
+
+	string modes[4] = { "batched", "threaded", "compressed", "compressed and threaded" };
+	long candidates = 0;
+
+	for (int m=-1; m<4; ++m)
+	{
+		ReadSlam::Genome g;
+		g.load(genome);
+		g.index_window = 5;
+		g.index_compressed = m >= 2;
+		g.batch_size = m == -1 ? 0 : 1000;
+		g.build_index(10, false, false);
+
+		if (m == -1)
+		{
+			g.map_reads(reads, "test_sampled.slam", true);
+			candidates = g.mapped_candidates;
+
+			check(g.index_positions() < full.index_positions(), "the minimizer-sampled index holds fewer positions than the full index");
+			continue;
+		}
+		if (m % 2)
+		{
+			g.system.cpus = 4;
+			g.map_threaded(reads, "test_sampled_mode.slam");
+		}
+		else
+		{
+			g.map_reads(reads, "test_sampled_mode.slam", true);
+		}
+		check(same_file("test_sampled.slam", "test_sampled_mode.slam"), "the minimizer-sampled index maps the same " + modes[m]);
+		check(g.mapped_candidates == candidates, "the minimizer-sampled index verifies the same candidates " + modes[m]);
+	}
+	check(valid_hits("test_sampled.slam", full), "the minimizer-sampled index reports the mismatches of the hits it places");
+
+	ifstream in_full ("test_full.slam");
+	ifstream in_sampled ("test_sampled.slam");
+	string line_full, line_sampled;
+	bool exact = true;
+
+	while (getline(in_full, line_full) && getline(in_sampled, line_sampled))
+	{
+		vector<string> f = Strings::tabsplit(line_full);
+		vector<string> s = Strings::tabsplit(line_sampled);
+
+		exact = exact && (f[0] == "0" || f[1] != "0" || (s[0] != "0" && s[1] == "0"));
+	}
+	check(exact, "the minimizer-sampled index finds every read the full index finds without mismatches");
+}
+
+//The genome-wide index maps every read the same way as the per-assembly index, both strands or forward only, on the
+//test genome and on a reference of many small contigs. It visits the assemblies in the order the seeds hit them, so
+//a read with several equally good locations may be reported at another of them. An index with no positions maps nothing
+void test_genome_wide(string genome, string reads)
+{
+	vector<string> contigs;
+	ofstream fa ("test_contigs.fa");
+
+	for (int i=0; i<300; ++i)
+	{
+		contigs.push_back(random_dna(500 + rand() % 2500));
+		fa << ">contig" << i << endl << contigs[i] << endl;
+	}
+	fa.close();
+	write_reads("test_contig_reads.slam", contigs, 2000);
+
+	string genomes[2] = { genome, "test_contigs.fa" };
+	string inputs[2] = { reads, "test_contig_reads.slam" };
+	bool same = true;
+
+	for (int i=0; i<2; ++i)
+	{
+		for (int single=0; single<2; ++single)
+		{
+			string files[2] = { "test_per_assembly.slam", "test_genome_wide.slam" };
+
+			for (int global=0; global<2; ++global)
+			{
+				ReadSlam::Genome g;
+				g.load(genomes[i]);
+				g.index_global = global;
+				g.build_index(10, false, false, single);
+				g.map_reads(inputs[i], files[global], true);
+			}
+			same = same && same_hits(files[0], files[1]);
+		}
+	}
+	check(same, "the genome-wide index maps the same as the per-assembly index");
+
+	ofstream empty ("test_empty.fa");
+	empty << ">chr1" << endl << string(5000, 'N') << endl << ">chr2" << endl << "ACGT" << endl;
+	empty.close();
+
+	ReadSlam::Genome g;
+	g.load("test_empty.fa");
+	g.index_global = true;
+	g.build_index(10, false, false);
+	g.map_reads(reads, "test_empty_out.slam", true);
+
+	check(g.mapped_failed == g.mapped_total, "a genome-wide index with no positions maps nothing");
+}
+
+int main (int argc, char * const argv[])
+{
+	srand(1);
+
+	vector<string> assemblies;
+	write_genome("test_genome.fa", assemblies);
+	write_reads("test_reads.slam", assemblies, 5000);
+
+	test_threaded("test_genome.fa", "test_reads.slam");
+	test_threaded_index();
+	test_no_tiles("test_genome.fa", assemblies);
+	test_duplicates("test_genome.fa", assemblies);
+	test_saved_index("test_genome.fa", "test_reads.slam");
+	test_shared_index("test_genome.fa", "test_reads.slam");
+	test_hash_index("test_genome.fa", "test_reads.slam");
+	test_sparse_index("test_genome.fa", "test_reads.slam");
+	test_single_strand("test_genome.fa", "test_reads.slam");
+	test_repeat_mask("test_genome.fa", "test_reads.slam");
+	test_unique_only("test_genome.fa", "test_reads.slam");
+	test_defaults("test_genome.fa", "test_reads.slam");
+	test_genome_wide("test_genome.fa", "test_reads.slam");
+	test_compressed("test_genome.fa", "test_reads.slam");
+	test_minimizers();
+	test_minimizer_index("test_genome.fa", "test_reads.slam");
+	test_kmer_keys();
+	test_fm_index();
+	test_suffix_array();
+	test_parallel_sort();
+	test_saved_bwt("test_genome.fa", "test_reads.slam");
+	test_bwt_mismatches("test_genome.fa", assemblies);
+
+	cout << (failures == 0 ? "All tests passed" : "Some tests failed") << endl;
+	return failures;
+}
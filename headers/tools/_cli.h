@@ -4,6 +4,7 @@
 #include "_parser.h"
 #include "_sorter.h"
 #include "../core/_genome.h"
+#include "_mapper_bwt.h"
 
 namespace ReadSlam
 {
@@ -14,13 +15,73 @@ namespace ReadSlam
 			ReadSlam::PreProcessor p;
 			p.trim(infile, outfile);
 		}
-		void map(string genome, string infile, string outfile, int seed, bool bisulfite, bool usemap)
+		void map(string genome, string infile, string outfile, int seed, bool bisulfite, bool usemap, const vector<string>& options)
 		{
 			ReadSlam::Genome g;
+			configure(g, options, true);
 			g.load(genome);
-			g.build_index(seed,bisulfite,usemap);
-			g.map_reads(infile,outfile,true);
-			//g.map_threaded(infile,outfile);
+			g.build_index(seed,bisulfite,usemap,g.index_single);
+			g.map_file(infile,outfile);
+		}
+		void map_sampled_stats(string genome, string infile, string outfile, int seed, bool bisulfite, int window)
+		{
+			ReadSlam::Genome g;
+			g.load(genome);
+			g.compare_sampled(infile,outfile,seed,bisulfite,window);
+		}
+		void map_bwt(string genome, string infile, string outfile, int mismatches, bool bisulfite, const vector<string>& options)
+		{
+			bool unique_only = bwt_options(options);
+			
+			ReadSlam::MapperBWT m;
+			m.load(genome);
+			m.unique_only = unique_only;
+			m.build(bisulfite,mismatches);
+			m.map(infile,outfile);
+		}
+		void index_bwt(string genome, string prefix, bool bisulfite)
+		{
+			ReadSlam::MapperBWT m;
+			m.load(genome);
+			m.build(bisulfite,0);
+			m.save_index(prefix);
+		}
+		void map_bwt_index(string genome, string prefix, string infile, string outfile, int mismatches, const vector<string>& options)
+		{
+			bool unique_only = bwt_options(options);
+			
+			ReadSlam::MapperBWT m;
+			m.load(genome);
+			m.unique_only = unique_only;
+			m.load_index(prefix,mismatches);
+			m.map(infile,outfile);
+		}
+		void index(string genome, string outfile, int seed, bool bisulfite)
+		{
+			ReadSlam::Genome g;
+			g.load(genome);
+			g.build_index(seed,bisulfite,false);
+			g.save_index(outfile);
+		}
+		void map_index(string genome, string index, string infile, string outfile, const vector<string>& options)
+		{
+			ReadSlam::Genome g;
+			configure(g, options, false);
+			g.load(genome);
+			g.load_index(index);
+			g.map_file(infile,outfile);
+		}
+		void map_shared(string genome, string name, string infile, string outfile, int seed, bool bisulfite, const vector<string>& options)
+		{
+			ReadSlam::Genome g;
+			configure(g, options, false);
+			g.load(genome);
+			g.share_index(name,seed,bisulfite);
+			g.map_file(infile,outfile);
+		}
+		void release_shared(string name, bool force)
+		{
+			if (!ReadSlam::SharedMemory::remove(name,force)) exit(1);
 		}
 		void stack(string genome, string infile, string outfile)
 		{
@@ -42,5 +103,59 @@ namespace ReadSlam
 		{
 			ReadSlam::Sorter::sort_reads(type,chunk,infile,outfile);
 		}
+		
+		//The BWT mappers only take --unique. Returns whether it was given
+		private: bool bwt_options(const vector<string>& options)
+		{
+			for (size_t i=0; i<options.size(); ++i)
+			{
+				if (options[i] != "--unique")
+				{
+					cerr << "Error: unknown option " << options[i] << " (BWT mapping only takes --unique)" << endl;
+					exit(1);
+				}
+			}
+			return !options.empty();
+		}
+		
+		//Apply the options given after a mapping command's parameters (eg. "--unique --pigeonhole 3"). Options that
+		//change how the index is laid out are only taken by commands that build their own index
+		private: void configure(Genome& g, const vector<string>& options, bool layout)
+		{
+			for (size_t i=0; i<options.size(); ++i)
+			{
+				string option = options[i];
+				bool valued = option == "--pigeonhole" || option == "--window" || option == "--repeats" || option == "--batch" || option == "--cache";
+				bool indexing = option == "--strand" || option == "--genome" || option == "--compressed" || option == "--window";
+				
+				if (valued && i + 1 == options.size())
+				{
+					cerr << "Error: option " << option << " needs a value" << endl;
+					exit(1);
+				}
+				if (indexing && !layout)
+				{
+					cerr << "Error: option " << option << " changes the index, so it cannot be used with a saved or shared index" << endl;
+					exit(1);
+				}
+				int value = valued ? atoi(options[++i].c_str()) : 0;
+				
+				if      (option == "--strand")     g.index_single = true;
+				else if (option == "--genome")     g.index_global = true;
+				else if (option == "--compressed") g.index_compressed = true;
+				else if (option == "--window")     g.index_window = value;
+				else if (option == "--pigeonhole") g.pigeonhole = value;
+				else if (option == "--unique")     g.unique_only = true;
+				else if (option == "--repeats")    g.repeat_threshold = value;
+				else if (option == "--batch")      g.batch_size = value;
+				else if (option == "--no-exact")   g.exact_first = false;
+				else if (option == "--cache")      g.cache_bits = value;
+				else
+				{
+					cerr << "Error: unknown option " << option << endl;
+					exit(1);
+				}
+			}
+		}
 	};
 }
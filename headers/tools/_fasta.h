@@ -1,6 +1,7 @@
 #pragma once
 
 #include "../common/_common.h"
+#include "../common/_sysinfo.h"
 #include "../core/_dna.h"
 #include "../algorithms/sorting.h"
 #include "../algorithms/burrows.h"
@@ -337,10 +338,11 @@ namespace ReadSlam
 				load(infile);
 				
 				BurrowsWheeler bw;
+				Sysinfo system;
 				
 				for (int i=0; i<assemblies.size(); ++i)
 				{
-					bw.encode(assemblies[i].sequence);
+					bw.encode(assemblies[i].sequence, system.cpus);
 					stringstream header;
 					header << bw.seed << ' ' << assemblies[i].name;
 					assemblies[i].name = header.str();
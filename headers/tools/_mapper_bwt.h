@@ -1,29 +1,35 @@
 #pragma once
 
 #include "../common/_common.h"
-#include "../core/_genome.h"
-#include "../core/_json.j"
+#include "../common/_sysinfo.h"
+#include "../core/_index_bwt.h"
 
 /**
- * Multi-threaded read-mapping using full-text search of a Burrows-Wheeler matrix
+ * Read-mapping using full-text search of a Burrows-Wheeler matrix (FM-index)
  * Reads to be mapped are expected to be in slam format
+ *
+ * Each assembly gets an IndexBWT. Building the FM-indices takes some time, so
+ * it is recommended to build them once, save them to disk and load them for
+ * future runs (the genome FastA is still needed to verify alignments).
  */
 namespace ReadSlam
 {
-	struct Mapper
+	struct MapperBWT
 	{
-		Genome genome;
-		
+		//The indices cannot be copied (their strands point at their own reference), so they are held by pointer
+		vector<IndexBWT*> indices;
+		bool unique_only; //Stop searching a read at its second exact hit (see Read::settled)
+
 		struct Stats
 		{
 			long total;
 			long unique;
 			long multi;
 			long failed;
-			
+
 			 Stats() { clear(); }
 			~Stats() { clear(); }
-			
+
 			void clear()
 			{
 				total = 0;
@@ -31,311 +37,136 @@ namespace ReadSlam
 				multi = 0;
 				failed = 0;
 			}
-			
+
 			void update(Read &read)
 			{
 				total++;
-				if (read.unique) unique++;
-				if (read.multi)  multi++;
-				if (read.failed) failed++;
+
+				switch (read.locations)
+				{
+					case 0  : failed++; break;
+					case 1  : unique++; break;
+					default : multi++; break;
+				}
+			}
+
+			void print()
+			{
+				cout << "Total: "  << total << endl;
+				cout << "Failed: " << failed << endl;
+				cout << "Unique: " << unique << endl;
+				cout << "Multi: "  << multi << endl;
 			}
 		} stats;
 
-		 Mapper() { stats.clear(); }
-		~Mapper() { stats.clear(); }
-		
-		//Single thread code
-		void *run_thread(void *infile_ptr)
+		 MapperBWT() { clear(); }
+		~MapperBWT() { clear(); }
+
+		void clear()
 		{
-			string infile = *((string *) infile_ptr);
-			string outfile = infile + ".mapping";
+			for (size_t i=0; i<indices.size(); ++i)
+			{
+				delete indices[i];
+			}
+			indices.clear();
+			stats.clear();
+			unique_only = false;
+		}
+
+		//Load the reference sequences from a FastA file
+		void load(string infile)
+		{
+			clear();
 
 			ifstream in (infile.c_str());
-			ofstream out (outfile.c_str());
+			PackedSequence packed;
+			string name;
 
-			in.open(infile.c_str(), fstream::in);
-			out.open(outfile.c_str(), fstream::out);
+			cout << "Loading genome: " << infile << endl;
 
-			//Reads are processed in batches of 1,000,000
-			int batch_size = 1000000;
-			vector<Read> reads;
-			reads.resize(batch_size);
-			
-			while (in.good() && !in.eof())
+			while (packed.load(in, name))
 			{
-				int loaded = 0;
-				
-				//Load reads
-				for (int i=0; i<batch_size; ++i)
-				{
-					if (!reads[i].load(in)) break;
-					loaded++;
-				}
-				
-				//Map reads
-				for (int i=0; i<loaded; ++i)
-				{
-					++progress;
-					genome.map(read);
-				}
-				
-				//Save reads
-				for (int i=0; i<loaded; ++i)
-				{
-					reads[i].save(out);
-				}
-				cout << "Mapped " << progress << " reads                  \r" << flush;
+				cout << "  - " << name << " (" << packed.length << ")" << endl;
+
+				IndexBWT* index = new IndexBWT();
+				index->init(name, packed);
+				indices.push_back(index);
 			}
-			out.close();
 			in.close();
+		}
 
-			remove(infile.c_str());
-			rename(outfile.c_str(), infile.c_str());
-		}	
-
-		//Multithreaded mapping initiation
-		void run(string infile, string outfile, int numthreads)
+		//Build the FM-indices
+		void build(bool bisulfite, int mismatches)
 		{
-			vector<string> readfiles;
-			vector<pthread_t> threads;
+			cout << endl << "Indexing:" << endl;
 
-			readfiles.resize(numthreads);
-			threads.resize(numthreads);
+			long memory = 0;
+			Sysinfo system;
 
-			//Split input for threads
-			{
-				for (int i=0; i<numthreads; i++)
-				{
-					readfiles[i] = Strings::add_int(outfile + ".thread.", i);
-				}
-				cout << "Splitting input for " << numthreads << " threads..." << flush;
-				Files::interleave_split(infile, readfiles);
-				cout << "done" << endl;
-			}
+			cout << "Sorting threads: " << system.cpus << endl;
 
-			//Launch threads to map reads
+			for (size_t i=0; i<indices.size(); ++i)
 			{
-				progress = 0;
-
-				for (int n=0; n<numthreads; ++n)
-				{
-					pthread_create(&(threads[n]), NULL, run_thread, (void*) &(readfiles[n]));
-				}
-				for (int n=0; n<numthreads; ++n)
-				{
-					pthread_join(threads[n], NULL);
-				}
+				cout << "  - indexing assembly: " << indices[i]->name << endl;
+				indices[i]->build(bisulfite, system.cpus);
+				indices[i]->mismatches = mismatches;
+				memory += indices[i]->fm_forward.memory() + indices[i]->fm_reverse.memory();
 			}
+			cout << "Index size: " << (memory / 1000000) << "MB" << endl;
+		}
 
-			//Merge results back into a final file
+		//Save the FM-indices (one file per assembly, named by its position in the genome)
+		void save_index(string prefix)
+		{
+			for (size_t i=0; i<indices.size(); ++i)
 			{
-				cout << "Merging results into single file..." << flush;
-				Files::interleave_join(readfiles, outfile);
-				cout << "done" << endl;
+				if (!indices[i]->save(Strings::add_int(prefix + ".", i))) exit(1);
 			}
+		}
 
-			//Clean up
+		//Load FM-indices written by save_index
+		void load_index(string prefix, int mismatches)
+		{
+			for (size_t i=0; i<indices.size(); ++i)
 			{
-				cout << "Cleaning up..." << flush;
-				for (int i=0; i<numthreads; i++)
-				{
-					remove(readfiles[i].c_str());
-				}
-				readfiles.clear();
-				cout << "done" << endl;
+				if (!indices[i]->load(Strings::add_int(prefix + ".", i))) exit(1);
+				indices[i]->mismatches = mismatches;
 			}
 		}
-		
-		void map(Genome& g, string infile, string outfile)
+
+		//Map a file of reads
+		void map(string infile, string outfile)
 		{
-			genome = g;
-			
 			ifstream in (infile.c_str());
 			ofstream out (outfile.c_str());
-			
-			long total = 0;
-			long unique = 0;
-			long multi = 0;
-			long failed = 0;
-			
-			FastQ fq;
+
 			Read read;
-			
+			stats.clear();
+
 			cout << endl;
 			cout << "Mapping:" << endl;
-			
-			while (fq.load(in))
+
+			while (read.load(in))
 			{
-				fq.to_read(read);
-				read.build_indices(seed, bisulfite);
+				read.unique_only = unique_only;
 				
-				if (++total % 1000 == 0)
-				{
-					cout << "  - " << total << "\r" << flush;
-				}
-				for (int i=0; i<num_assemblies; ++i)
-				{
-					read.search(assemblies[i].forward);
-					read.search(assemblies[i].reverse);
-				}
-				if (read.locations == 0)
-				{
-					failed++;
-					//read.dump();
-				}
-				else if (read.locations == 1)
-				{
-					unique++;
-					read.save(out);
-				}
-				else
+				for (size_t i=0; i<indices.size() && !read.settled(); ++i)
 				{
-					multi++;
+					indices[i]->search(read);
 				}
-			}
-			out.close();
-			in.close();
-			
-			cout << "  - " << total << endl;
-			cout << "Total: " << total << endl;
-			cout << "Failed: " << failed << endl;
-			cout << "Unique: " << unique << endl;
-			cout << "Multi: " << multi << endl;
-		}
-		
-		//Generate statistics for a file of mapped reads (could be done on the fly)
-		void print_stats(string infile)
-		{
-			
-			ifstream in (infile.c_str());
+				stats.update(read);
+				read.save(out);
 
-			long total = 0;
-			long unique = 0;
-			long multi = 0;
-			long failed = 0;
-
-			Read read;
-
-			while (fq.load(in))
-			{
-				fq.to_read(read);
-				read.build_indices(seed, bisulfite);
-
-				if (++total % 1000 == 0)
-				{
-					cout << "  - " << total << "\r" << flush;
-				}
-				for (int i=0; i<num_assemblies; ++i)
-				{
-					read.search(assemblies[i].forward);
-					read.search(assemblies[i].reverse);
-				}
-				if (read.locations == 0)
+				if (stats.total % 1000 == 0)
 				{
-					failed++;
-					//read.dump();
-				}
-				else if (read.locations == 1)
-				{
-					unique++;
-					read.save(out);
-				}
-				else
-				{
-					multi++;
+					cout << "  - " << stats.total << "\r" << flush;
 				}
 			}
 			out.close();
 			in.close();
 
-			cout << "  - " << total << endl;
-			cout << "Total: " << total << endl;
-			cout << "Failed: " << failed << endl;
-			cout << "Unique: " << unique << endl;
-			cout << "Multi: " << multi << endl;
+			cout << "  - " << stats.total << endl;
+			stats.print();
 		}
-	};	
+	};
 }
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-/*
- * A mapper that makes use of the Burrows-Wheeler transformation
- * The DNA sequence is encoded and linked to support full-text search
- *
- * Encoding can take some time, so it is recommended to build an encoding and save it to disk for future use
- */
-namespace ReadSlam
-{
-	//Encode sequences in a FastA file using the Burrows-Wheeler transformation
-	void encode_genome(string infile, string outfile)
-	{
-		ReadSlam::FastA::Genome genome;
-		genome.load(infile);
-		
-		//Encode each of the sequences
-		for (int i=0; i<genome.assemblies.size(); ++i)
-		{
-			bw.build(genome.assemblies[i].sequence, false, 0);
-			bw.encode(genome.assemblies[i].sequence); //seed is stored in the string
-		}
-		genome.save(outfile);
-	}
-	
-	//Decode a FastA file that has been encoded using 'encode_genome'
-	void decode_genome(string infile, string outfile)
-	{
-		ReadSlam::FastA::Genome genome;
-		genome.load(infile);
-		
-		//Decode each of the sequences
-		for (int i=0; i<genome.assemblies.size(); ++i)
-		{
-			//Retrieve the seed value
-			bw.build(genome.assemblies[i].sequence, true, 0);
-			bw.decode(genome.assemblies[i].sequence);
-		}
-		genome.save(outfile);
-	}
-	
-	//Load an encoded genome and build the search index for each sequence
-	void load_encoded(string infile)
-	{
-		ReadSlam::FastA::Genome genome;
-		genome.load(infile);
-		
-		//Encode each of the sequences
-		for (int i=0; i<genome.assemblies.size(); ++i)
-		{
-			bw.build(genome.assemblies[i].sequence, false, 0);
-		}
-	}
-	
-	//Lookup a sequence in the genome
-	vector<Hit> search(string &sequence)
-	{
-		return genome.search(sequence);
-	}
-}
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include "../common/_common.h"
 #include "../parsing/_slam.h"
 #include "_fasta.h"
+#include "../core/_packed.h"
 
 namespace ReadSlam
 {
@@ -58,16 +59,45 @@ namespace ReadSlam
 			
 			for (int i=0; i<length; ++i)
 			{
-				switch(sequence[i])
+				set_reference(stacks[i], sequence[i]);
+			}
+		}
+		
+		//Initialize the stack using a packed reference sequence (decoded a chunk at a time)
+		void initialize(const string& name, PackedSequence& reference)
+		{
+			assembly = name;
+			length = reference.length;
+			stacks.clear();
+			stacks.resize(length);
+			
+			const int chunk = 1000000;
+			string buffer (chunk, 'N');
+			
+			for (int i=0; i<length; i+=chunk)
+			{
+				int n = min(chunk, length - i);
+				reference.extract(i, n, &(buffer[0]));
+				
+				for (int j=0; j<n; ++j)
 				{
-					case 'A' : stacks[i].fref = 'A'; stacks[i].rref = 'T'; break;
-					case 'T' : stacks[i].fref = 'T'; stacks[i].rref = 'A'; break;
-					case 'C' : stacks[i].fref = 'C'; stacks[i].rref = 'G'; break;
-					case 'G' : stacks[i].fref = 'G'; stacks[i].rref = 'C'; break;
-					default  : stacks[i].fref = 'N'; stacks[i].rref = 'N'; break;
+					set_reference(stacks[i+j], buffer[j]);
 				}
 			}
-		}		
+		}
+		
+		//Set the reference bases of a stack from the forward strand base
+		void set_reference(Stack& stack, char base)
+		{
+			switch(base)
+			{
+				case 'A' : stack.fref = 'A'; stack.rref = 'T'; break;
+				case 'T' : stack.fref = 'T'; stack.rref = 'A'; break;
+				case 'C' : stack.fref = 'C'; stack.rref = 'G'; break;
+				case 'G' : stack.fref = 'G'; stack.rref = 'C'; break;
+				default  : stack.fref = 'N'; stack.rref = 'N'; break;
+			}
+		}
 		
 		//Add a read to the stack
 		void add(BasicRead& read)
@@ -309,25 +339,26 @@ namespace ReadSlam
 			clear();
 			
 			cout << "Loading genome" << endl;
-			FastA::Genome genome;
-			genome.load(ref);
+			
+			//One assembly at a time, packed, so the genome is never held as text
+			ifstream in (ref.c_str());
+			PackedSequence packed;
+			string name;
 
-			for (int i=0; i<genome.assemblies.size(); ++i)
+			while (packed.load(in, name))
 			{
-				FastA::Assembly* a = &(genome.assemblies[i]);
-				
-				Strings::replace(a->name, "chr", "");
-				Strings::replace(a->name, "_u", "");
-				Strings::replace(a->name, " ", "");
-				Strings::replace(a->name, ">", "");
+				Strings::replace(name, "chr", "");
+				Strings::replace(name, "_u", "");
+				Strings::replace(name, " ", "");
+				Strings::replace(name, ">", "");
 								
-				cout << " - initializing stack for assembly " << a->name << " (" << a->length << ")" << endl;
+				cout << " - initializing stack for assembly " << name << " (" << packed.length << ")" << endl;
 				
 				Stacks s;
-				stacks[a->name] = s;
-				stacks[a->name].initialize(a->name,a->sequence);
+				stacks[name] = s;
+				stacks[name].initialize(name,packed);
 			}
-			genome.clear();
+			in.close();
 			ready = true;
 		}
 		
@@ -3,7 +3,7 @@
 #include "../common/_common.h"
 #include "../parsing/_slam.h"
 #include "../core/_dna.h"
-#include "_fasta.h"
+#include "../core/_packed.h"
 #include <map>
 
 
@@ -36,8 +36,7 @@ namespace ReadSlam
 		{
 			int size;
 			string name;
-			string forward;
-			string reverse;
+			PackedSequence reference; //2 bits per base, both strands are read through it
 		};
 		
 		map<string, Assembly> genome;
@@ -47,26 +46,25 @@ namespace ReadSlam
 		{
 			cout << "Loading genome" << endl;
 			
-			FastA::Genome f;
-			f.load(infile);
+			ifstream in (infile.c_str());
+			PackedSequence packed;
+			string name;
 			
-			for (int i=0; i<f.assemblies.size(); ++i)
+			while (packed.load(in, name))
 			{
-				Assembly a;
-				a.size = f.assemblies[i].length;
-				a.name = f.assemblies[i].name;
-				a.forward = f.assemblies[i].sequence;
-				a.reverse = DNA::complement(a.forward);
+				Strings::replace(name, "chr", "");
+				Strings::replace(name, "_u", "");
+				Strings::replace(name, " ", "");
+				Strings::replace(name, ">", "");
 				
-				Strings::replace(a.name, "chr", "");
-				Strings::replace(a.name, "_u", "");
-				Strings::replace(a.name, " ", "");
-				Strings::replace(a.name, ">", "");
-				
-				genome[a.name] = a;
+				Assembly& a = genome[name];
+				a.size = packed.length;
+				a.name = name;
+				a.reference.swap(packed);
 				
 				cout << " - loaded " << a.name << endl;
 			}
+			in.close();
 		}
 		
 		//Recommended limits: noncg <= 3, mismatch <= 3, size >= 20
@@ -94,12 +92,12 @@ namespace ReadSlam
 				if (read.strand == "+")
 				{
 					if (read.position + len + 1 >= genome[read.assembly].size-2) continue;
-					ref = genome[read.assembly].forward.substr(read.position,len+1);
+					ref = genome[read.assembly].reference.substr(read.position,len+1);
 				}
 				else
 				{
 					if (read.position == 0) continue;
-					ref = DNA::reverse(genome[read.assembly].reverse.substr(read.position-1,len+1));
+					ref = DNA::reverse_complement(genome[read.assembly].reference.substr(read.position-1,len+1));
 				}
 				
 				//Apply filtering rules